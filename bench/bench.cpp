@@ -0,0 +1,472 @@
+// mcmap microbenchmarks
+// Times the hot spots of the rendering pipeline on the chunks of a real world:
+// every benchmark runs its operation in a loop until a sample lasts long
+// enough, and repeats the sample to report stable per-operation numbers. The
+// results can be saved as json and compared against a previous run.
+
+#include "../src/canvas.h"
+#include "../src/colors.h"
+#include "../src/compression.h"
+#include "../src/draw_png.h"
+#include "../src/helper.h"
+#include "../src/logger.h"
+#include "../src/worldloader.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fmt/core.h>
+#include <functional>
+#include <json.hpp>
+#include <string>
+#include <vector>
+
+using nlohmann::json;
+using std::string;
+using std::vector;
+using std::filesystem::path;
+
+struct Options {
+  path save;
+  uint16_t repetitions = 7;
+  double minTime = 0.05; // Minimum duration of a sample, in seconds
+  int32_t size = 256;    // Side of the square of terrain loaded, in blocks
+  path saveFile, baselineFile;
+  double threshold = 10; // Tolerated slowdown against the baseline, in %
+  string filter;
+};
+
+struct Result {
+  string name, unit;
+  uint64_t iterations;    // Calls of the benchmark per sample
+  vector<double> samples; // Nanoseconds per unit
+
+  double median() const {
+    vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[sorted.size() / 2];
+  }
+
+  double min() const {
+    return *std::min_element(samples.begin(), samples.end());
+  }
+
+  double max() const {
+    return *std::max_element(samples.begin(), samples.end());
+  }
+};
+
+// A benchmark runs its operation once, and returns the number of units
+// processed (chunks, blocks, pixels...)
+typedef std::function<uint64_t()> Benchmark;
+
+// Values computed by the benchmarks are written here so the compiler cannot
+// optimize the work away
+volatile uint64_t sink = 0;
+
+double since(const std::chrono::steady_clock::time_point &start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+bool measure(const Options &options, const string &name, const string &unit,
+             Benchmark benchmark, vector<Result> *results) {
+  if (!options.filter.empty() && name.find(options.filter) == string::npos)
+    return false;
+
+  Result result = {name, unit, 1, {}};
+
+  // Warm up the caches, and find the number of calls needed for a sample to
+  // last at least the minimum time
+  for (;;) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++)
+      benchmark();
+    const double elapsed = since(start);
+
+    if (elapsed >= options.minTime)
+      break;
+
+    result.iterations *= (elapsed > options.minTime / 10 ? 2 : 10);
+  }
+
+  for (uint16_t repetition = 0; repetition < options.repetitions;
+       repetition++) {
+    uint64_t units = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < result.iterations; i++)
+      units += benchmark();
+    const double elapsed = since(start);
+
+    result.samples.push_back(units ? elapsed * 1e9 / units : 0);
+  }
+
+  fmt::print("{:<20} {:>12.2f} ns/{:<7} (min {:.2f}, max {:.2f}, {} x {})\n",
+             name, result.median(), unit, result.min(), result.max(),
+             options.repetitions, result.iterations);
+
+  results->push_back(result);
+  return true;
+}
+
+json toJson(const vector<Result> &results) {
+  json data = {{"benchmarks", json::object()}};
+
+  for (auto &result : results)
+    data["benchmarks"][result.name] = {
+        {"unit", result.unit},
+        {"median_ns", result.median()},
+        {"min_ns", result.min()},
+        {"max_ns", result.max()},
+        {"iterations", result.iterations},
+        {"samples", result.samples},
+    };
+
+  return data;
+}
+
+// Compare the medians with the ones of a saved run. Returns false if a
+// benchmark got slower than the threshold allows.
+bool compare(const vector<Result> &results, const path &file,
+             const double threshold) {
+  FILE *f = fopen(file.c_str(), "r");
+  json baseline;
+
+  if (!f) {
+    logger::error("Opening baseline {} failed: {}\n", file.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  try {
+    baseline = json::parse(f)["benchmarks"];
+  } catch (const nlohmann::detail::exception &err) {
+    logger::error("Parsing baseline {} failed: {}\n", file.c_str(),
+                  err.what());
+    fclose(f);
+    return false;
+  }
+
+  fclose(f);
+
+  bool passed = true;
+  fmt::print("\n{:<20} {:>12} {:>12} {:>9}\n", "benchmark", "baseline",
+             "current", "change");
+
+  for (auto &result : results) {
+    if (!baseline.contains(result.name) ||
+        !baseline[result.name].contains("median_ns"))
+      continue;
+
+    const double before = baseline[result.name]["median_ns"].get<double>(),
+                 after = result.median();
+    const double change = before > 0 ? (after - before) / before * 100 : 0;
+    const bool regressed = change > threshold;
+
+    fmt::print("{:<20} {:>12.2f} {:>12.2f} {:>+8.1f}%{}\n", result.name,
+               before, after, change, regressed ? " REGRESSION" : "");
+
+    passed = passed && !regressed;
+  }
+
+  return passed;
+}
+
+void printHelp(char *binary) {
+  logger::info("Usage: {} <options> WORLD\n"
+               "  -repeat N        number of samples per benchmark [7]\n"
+               "  -time S          minimum duration of a sample in seconds "
+               "[0.05]\n"
+               "  -size N          side of the terrain loaded in blocks "
+               "[256]\n"
+               "  -only NAME       only run the benchmarks containing NAME\n"
+               "  -save FILE       save the results as json to FILE\n"
+               "  -compare FILE    compare the results with the ones saved "
+               "in FILE\n"
+               "  -threshold PCT   slowdown tolerated when comparing [10]\n",
+               binary);
+}
+
+bool parseArgs(int argc, char **argv, Options *options) {
+#define ISARG(X) !strcmp(argv[i], X)
+#define NEXTARG argv[++i]
+  for (int i = 1; i < argc; i++) {
+    if (i < argc - 2 && ISARG("-repeat")) {
+      options->repetitions = std::max(atoi(NEXTARG), 1);
+    } else if (i < argc - 2 && ISARG("-time")) {
+      options->minTime = atof(NEXTARG);
+    } else if (i < argc - 2 && ISARG("-size")) {
+      options->size = std::max(atoi(NEXTARG), 16);
+    } else if (i < argc - 2 && ISARG("-only")) {
+      options->filter = NEXTARG;
+    } else if (i < argc - 2 && ISARG("-save")) {
+      options->saveFile = NEXTARG;
+    } else if (i < argc - 2 && ISARG("-compare")) {
+      options->baselineFile = NEXTARG;
+    } else if (i < argc - 2 && ISARG("-threshold")) {
+      options->threshold = atof(NEXTARG);
+    } else if (i == argc - 1) {
+      options->save = argv[i];
+    } else {
+      logger::error("Unknown argument {}\n", argv[i]);
+      return false;
+    }
+  }
+#undef ISARG
+#undef NEXTARG
+
+  if (options->save.empty() || !std::filesystem::is_directory(options->save)) {
+    logger::error("Invalid world directory\n");
+    return false;
+  }
+
+  return true;
+}
+
+// A section ready to be decoded
+struct Section {
+  uint64_t bits;
+  const vector<int64_t> *states;
+};
+
+int main(int argc, char **argv) {
+  Options options;
+
+  if (argc < 2 || !parseArgs(argc, argv, &options)) {
+    printHelp(argv[0]);
+    return 1;
+  }
+
+  // The rendering code reports its progress, which is noise here
+  logger::setQuiet();
+  srand(1337);
+
+  path regionDir = options.save / "region";
+  if (!std::filesystem::is_directory(regionDir))
+    regionDir = options.save;
+
+  // Load the first square of existing terrain of the world
+  Coordinates coords;
+  Terrain::ChunkSet existing;
+  scanWorldDirectory(regionDir, &coords, &existing);
+
+  if (coords.isUndefined()) {
+    logger::error("No chunks found in {}\n", regionDir.c_str());
+    return 1;
+  }
+
+  coords.maxX = std::min(coords.maxX, coords.minX + options.size - 1);
+  coords.maxZ = std::min(coords.maxZ, coords.minZ + options.size - 1);
+  coords.minY = 0;
+  coords.maxY = 255;
+
+  Terrain::Data world(coords);
+  world.load(regionDir, &existing);
+
+  coords.minY = std::max(coords.minY, world.minHeight());
+  coords.maxY = std::min(coords.maxY, world.maxHeight());
+
+  Colors::Palette colors, localColors;
+  Colors::load("", &colors);
+  Colors::filter(colors, world.cache, &localColors);
+
+  // Gather the compressed and decompressed payloads of the chunks loaded
+  vector<Terrain::ChunkData> compressed, inflated;
+  vector<uint8_t> types;
+  for (auto &chunk : world.chunks) {
+    const int32_t x = Terrain::keyX(chunk.first),
+                  z = Terrain::keyZ(chunk.first);
+    auto region = Terrain::RegionCache::global().open(
+        regionDir / fmt::format("r.{}.{}.mca", REGION(x), REGION(z)),
+        REGION(x), REGION(z));
+
+    const uint8_t *data;
+    uint32_t length;
+    uint8_t type;
+    uint64_t size;
+    Terrain::ChunkData buffer(DECOMPRESSED_BUFFER);
+
+    if (!region ||
+        !region->chunkData((x & 0x1f) + (z & 0x1f) * 32, &data, &length,
+                           &type) ||
+        type & 0x80 || !decompressChunk(data, length, type, &buffer, &size))
+      continue;
+
+    buffer.resize(size);
+    compressed.emplace_back(data, data + length);
+    types.push_back(type);
+    inflated.push_back(std::move(buffer));
+  }
+
+  // Sort the sections of the chunks by format
+  vector<Section> pre116, post116;
+  for (auto &chunk : world.chunks) {
+    const bool post = chunk.second["DataVersion"].get<int>() >= 2534;
+
+    for (auto &section : chunk.second["Level"]["Sections"]) {
+      if (!section.contains("Palette") || !section.contains("BlockStates"))
+        continue;
+
+      const uint64_t bits = std::max(
+          uint64_t(ceil(log2(section["Palette"].size()))), uint64_t(4));
+      const vector<int64_t> *states =
+          section["BlockStates"].get<const vector<int64_t> *>();
+
+      if (states->size() >= statesLength(bits, post))
+        (post ? post116 : pre116).push_back({bits, states});
+    }
+  }
+
+  fmt::print("Benchmarking on {} chunks, {} pre-1.16 and {} 1.16+ "
+             "sections\n\n",
+             inflated.size(), pre116.size(), post116.size());
+
+  vector<Result> results;
+
+  // Loading
+  if (!compressed.empty()) {
+    measure(options, "inflate", "chunk", [&]() {
+      static Terrain::ChunkData buffer(DECOMPRESSED_BUFFER);
+      uint64_t size;
+      for (size_t i = 0; i < compressed.size(); i++)
+        decompressChunk(compressed[i].data(), compressed[i].size(), types[i],
+                        &buffer, &size);
+      return compressed.size();
+    }, &results);
+
+    // The streaming inflate of zlib, used when the single pass decoder fails
+    measure(options, "inflate_zlib", "chunk", [&]() {
+      static Terrain::ChunkData buffer(DECOMPRESSED_BUFFER);
+      uint64_t size, count = 0;
+      for (size_t i = 0; i < compressed.size(); i++)
+        if (types[i] == Compression::GZIP || types[i] == Compression::ZLIB) {
+          Compression::inflateStream(compressed[i].data(),
+                                     compressed[i].size(), &buffer, &size);
+          count++;
+        }
+      return count;
+    }, &results);
+
+    measure(options, "nbt_parse", "chunk", [&]() {
+      for (auto &data : inflated)
+        sink += NBT::parse(data.data(), data.size()).size();
+      return inflated.size();
+    }, &results);
+  }
+
+  // Section decoding, block by block versus the whole section at once
+  auto blockAt = [](const vector<Section> &sections, sectionInterpreter get) {
+    return [&sections, get]() {
+      uint64_t sum = 0;
+      for (auto &section : sections)
+        for (uint8_t y = 0; y < 16; y++)
+          for (uint8_t z = 0; z < 16; z++)
+            for (uint8_t x = 0; x < 16; x++)
+              sum += get(section.bits, section.states, x, z, y);
+      sink += sum;
+      return sections.size() * 4096;
+    };
+  };
+
+  auto decode = [](const vector<Section> &sections, sectionDecoder decoder) {
+    return [&sections, decoder]() {
+      uint16_t blocks[4096];
+      for (auto &section : sections) {
+        decoder(section.bits, section.states, blocks);
+        sink += blocks[4095];
+      }
+      return sections.size() * 4096;
+    };
+  };
+
+  if (!pre116.empty()) {
+    measure(options, "block_at_pre116", "block", blockAt(pre116, blockAtPre116),
+            &results);
+    measure(options, "decode_pre116", "block", decode(pre116, decodePre116),
+            &results);
+  }
+
+  if (!post116.empty()) {
+    measure(options, "block_at_post116", "block",
+            blockAt(post116, blockAtPost116), &results);
+    measure(options, "decode_post116", "block", decode(post116, decodePost116),
+            &results);
+  }
+
+  // Drawing a block over the whole canvas, opaque then translucent
+  IsometricCanvas canvas(coords, localColors);
+  const Colors::Block opaque(Colors::BlockTypes::FULL, {120, 110, 100, 255}),
+      translucent(Colors::BlockTypes::FULL, {40, 60, 200, 120});
+
+  auto draw = [&canvas](const Colors::Block *block) {
+    return [&canvas, block]() {
+      uint64_t drawn = 0;
+      for (uint32_t y = 0; y + 4 <= canvas.height; y += 4)
+        for (uint32_t x = 0; x + 4 <= canvas.width; x += 4, drawn++)
+          canvas.drawFull(x, y, minecraft_air, block);
+      return drawn;
+    };
+  };
+
+  measure(options, "draw_full", "block", draw(&opaque), &results);
+  measure(options, "draw_blend", "block", draw(&translucent), &results);
+
+  // Rendering the terrain in two splits, and merging them
+  Coordinates *subCoords = new Coordinates[2];
+  splitCoords(coords, subCoords, 2);
+
+  measure(options, "render", "chunk", [&]() {
+    IsometricCanvas rendered(coords, localColors);
+    rendered.renderTerrain(world);
+    return world.chunks.size();
+  }, &results);
+
+  IsometricCanvas first(subCoords[0], localColors),
+      second(subCoords[1], localColors), merged(coords, localColors);
+
+  for (auto split : {&first, &second}) {
+    Terrain::Data part(split->map);
+    part.load(regionDir, &existing);
+    split->renderTerrain(part);
+  }
+
+  delete[] subCoords;
+
+  measure(options, "merge", "pixel", [&]() {
+    merged.merge(first);
+    merged.merge(second);
+    return first.width * first.height + second.width * second.height;
+  }, &results);
+
+  // Cropping and encoding the final image
+  measure(options, "crop", "image", [&]() {
+    sink += merged.getCroppedOffset() + merged.getCroppedWidth() +
+            merged.getCroppedHeight();
+    return 1;
+  }, &results);
+
+  measure(options, "png_encode", "pixel", [&]() {
+    PNG::Image("/dev/null", &merged).save();
+    return uint64_t(merged.getCroppedWidth()) * merged.getCroppedHeight();
+  }, &results);
+
+  if (!options.saveFile.empty()) {
+    FILE *f = fopen(options.saveFile.c_str(), "w");
+
+    if (!f) {
+      logger::error("Opening {} failed: {}\n", options.saveFile.c_str(),
+                    strerror(errno));
+      return 1;
+    }
+
+    fmt::print(f, "{}\n", toJson(results).dump(2));
+    fclose(f);
+  }
+
+  if (!options.baselineFile.empty() &&
+      !compare(results, options.baselineFile, options.threshold))
+    return 2;
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <png.h>
+#include <vector>
+
+using std::filesystem::exists;
+using std::filesystem::path;
+
+// Hash the pixels of a PNG image, ignoring the way they were encoded: two
+// images with the same dimensions and RGBA values have the same hash
+int main(int argc, char **argv) {
+  if (argc < 2 || !exists(path(argv[1]))) {
+    fmt::print(stderr, "Usage: {} <PNG file>\n", argv[0]);
+    return 1;
+  }
+
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_file(&image, argv[1])) {
+    fmt::print(stderr, "Error reading {}: {}\n", argv[1], image.message);
+    return 1;
+  }
+
+  image.format = PNG_FORMAT_RGBA;
+  std::vector<uint8_t> pixels(PNG_IMAGE_SIZE(image));
+
+  if (!png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr)) {
+    fmt::print(stderr, "Error reading {}: {}\n", argv[1], image.message);
+    return 1;
+  }
+
+  // 64 bit FNV-1a, over the dimensions then the pixels
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto feed = [&hash](const uint8_t byte) {
+    hash ^= byte;
+    hash *= 0x100000001b3ULL;
+  };
+
+  for (uint8_t shift = 0; shift < 32; shift += 8) {
+    feed(image.width >> shift);
+    feed(image.height >> shift);
+  }
+
+  for (auto byte : pixels)
+    feed(byte);
+
+  fmt::print("{:016x} {}x{}\n", hash, image.width, image.height);
+  return 0;
+}
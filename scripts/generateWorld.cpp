@@ -0,0 +1,899 @@
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#define REGIONSIZE 32
+#define SECTOR 4096
+#define MAX_SECTORS 255
+#define HEIGHT 256
+#define SEA_LEVEL 62
+
+// Data versions written in the chunks, on both sides of the 1.16 change in the
+// block states format
+#define VERSION_PRE116 2230  // 1.15.2
+#define VERSION_POST116 2586 // 1.16.5
+
+using std::string;
+using std::vector;
+using std::filesystem::path;
+
+// Terrain profiles
+// Each profile stresses a different part of the renderer:
+// - flat: a few full sections, the most simple case;
+// - hills: noisy terrain, water, vegetation and trees;
+// - ocean: deep water over a low floor, with underwater plants;
+// - builds: hills covered with buildings made of hundreds of block states,
+//   giving sections with palettes over 256 entries;
+// - hollow: hills with their underground sections empty or missing;
+// - oversized: hills with a few chunks too big to fit in their region, that
+//   are stored in external .mcc files.
+enum Profile { FLAT, HILLS, OCEAN, BUILDS, HOLLOW, OVERSIZED };
+
+const std::map<string, Profile> profiles = {
+    {"flat", FLAT},     {"hills", HILLS},   {"ocean", OCEAN},
+    {"builds", BUILDS}, {"hollow", HOLLOW}, {"oversized", OVERSIZED},
+};
+
+// Which format the chunks use: all pre-1.16, all 1.16+, or alternating in a
+// checkerboard pattern
+enum Format { PRE116, POST116, MIXED };
+
+const std::map<string, Format> formats = {
+    {"1.15", PRE116},
+    {"1.16", POST116},
+    {"mixed", MIXED},
+};
+
+// How the chunks are compressed, the values being the compression types of
+// the region format. LZ4 streams are written like lz4-java does.
+enum Compression { GZIP = 1, ZLIB = 2, NONE = 3, LZ4 = 4 };
+
+const std::map<string, Compression> compressions = {
+    {"gzip", GZIP},
+    {"zlib", ZLIB},
+    {"none", NONE},
+    {"lz4", LZ4},
+};
+
+// The blocks buildings are made of
+const vector<string> buildingBlocks = {
+    "minecraft:stone_bricks",     "minecraft:mossy_stone_bricks",
+    "minecraft:cracked_stone_bricks", "minecraft:chiseled_stone_bricks",
+    "minecraft:cobblestone",      "minecraft:mossy_cobblestone",
+    "minecraft:bricks",           "minecraft:sandstone",
+    "minecraft:cut_sandstone",    "minecraft:smooth_sandstone",
+    "minecraft:granite",          "minecraft:polished_granite",
+    "minecraft:diorite",          "minecraft:polished_diorite",
+    "minecraft:andesite",         "minecraft:polished_andesite",
+    "minecraft:smooth_stone",     "minecraft:obsidian",
+    "minecraft:bookshelf",        "minecraft:iron_block",
+    "minecraft:gold_block",       "minecraft:lapis_block",
+    "minecraft:diamond_block",    "minecraft:emerald_block",
+    "minecraft:redstone_block",   "minecraft:coal_block",
+    "minecraft:snow_block",       "minecraft:packed_ice",
+    "minecraft:clay",             "minecraft:crafting_table",
+    "minecraft:furnace",          "minecraft:barrel",
+};
+
+struct Options {
+  path save;
+  Profile profile = HILLS;
+  Format format = MIXED;
+  int32_t originX = 0, originZ = 0; // First chunk generated
+  uint32_t size = 32;               // Side of the square generated, in chunks
+  uint64_t seed = 0;
+  Compression compression = ZLIB;
+};
+
+// Deterministic hashing of coordinates, used as the only source of randomness
+// so the output only depends on the seed and the position
+uint64_t hash(const uint64_t seed, const int64_t a, const int64_t b,
+              const int64_t c = 0) {
+  uint64_t x = seed ^ (uint64_t(a) * 0x9E3779B97F4A7C15ULL) ^
+               (uint64_t(b) * 0xC2B2AE3D27D4EB4FULL) ^
+               (uint64_t(c) * 0x165667B19E3779F9ULL);
+
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Value in [0, 1) from a hash
+double unit(const uint64_t value) {
+  return double(value >> 11) / double(uint64_t(1) << 53);
+}
+
+int64_t floorDiv(const int64_t a, const int64_t b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+// Value noise in [0, 1), interpolated between points of a grid of the given
+// scale
+double noise(const uint64_t seed, const int64_t x, const int64_t z,
+             const int64_t scale) {
+  const int64_t gridX = floorDiv(x, scale), gridZ = floorDiv(z, scale);
+  double fx = double(x - gridX * scale) / scale,
+         fz = double(z - gridZ * scale) / scale;
+
+  fx = fx * fx * (3 - 2 * fx);
+  fz = fz * fz * (3 - 2 * fz);
+
+  const double v00 = unit(hash(seed, gridX, gridZ, scale)),
+               v10 = unit(hash(seed, gridX + 1, gridZ, scale)),
+               v01 = unit(hash(seed, gridX, gridZ + 1, scale)),
+               v11 = unit(hash(seed, gridX + 1, gridZ + 1, scale));
+
+  return (v00 * (1 - fx) + v10 * fx) * (1 - fz) +
+         (v01 * (1 - fx) + v11 * fx) * fz;
+}
+
+// NBT writer
+// Appends big-endian tags to a buffer. Compounds and lists are closed by the
+// caller.
+struct NBTWriter {
+  vector<uint8_t> data;
+
+  void u8(const uint8_t value) { data.push_back(value); }
+  void u16(const uint16_t value) {
+    u8(value >> 8);
+    u8(value);
+  }
+  void u32(const uint32_t value) {
+    u16(value >> 16);
+    u16(value);
+  }
+  void u64(const uint64_t value) {
+    u32(value >> 32);
+    u32(value);
+  }
+
+  void str(const string &value) {
+    u16(value.size());
+    data.insert(data.end(), value.begin(), value.end());
+  }
+
+  void header(const uint8_t type, const string &name) {
+    u8(type);
+    str(name);
+  }
+
+  void byteTag(const string &name, const int8_t value) {
+    header(1, name);
+    u8(value);
+  }
+
+  void intTag(const string &name, const int32_t value) {
+    header(3, name);
+    u32(value);
+  }
+
+  void stringTag(const string &name, const string &value) {
+    header(8, name);
+    str(value);
+  }
+
+  void byteArray(const string &name, const vector<uint8_t> &values) {
+    header(7, name);
+    u32(values.size());
+    data.insert(data.end(), values.begin(), values.end());
+  }
+
+  void longArray(const string &name, const vector<int64_t> &values) {
+    header(12, name);
+    u32(values.size());
+    for (auto value : values)
+      u64(value);
+  }
+
+  void compound(const string &name) { header(10, name); }
+  void list(const string &name, const uint8_t type, const uint32_t count) {
+    header(9, name);
+    u8(type);
+    u32(count);
+  }
+  void end() { u8(0); }
+};
+
+// Pack indexes of the given bit length in longs, as the game does
+vector<int64_t> pack(const vector<uint16_t> &indexes, const uint8_t bits,
+                     const bool post116) {
+  vector<int64_t> longs;
+
+  if (post116) {
+    // Since 1.16, indexes do not span two longs
+    const uint8_t perLong = 64 / bits;
+    longs.resize((indexes.size() + perLong - 1) / perLong, 0);
+
+    for (size_t i = 0; i < indexes.size(); i++)
+      longs[i / perLong] |= int64_t(uint64_t(indexes[i])
+                                    << ((i % perLong) * bits));
+  } else {
+    longs.resize((indexes.size() * bits + 63) / 64, 0);
+
+    for (size_t i = 0; i < indexes.size(); i++) {
+      const uint64_t bit = i * bits;
+      longs[bit / 64] |= int64_t(uint64_t(indexes[i]) << (bit % 64));
+      if (bit % 64 + bits > 64)
+        longs[bit / 64 + 1] |= int64_t(uint64_t(indexes[i]) >> (64 - bit % 64));
+    }
+  }
+
+  return longs;
+}
+
+// Block states, interned in a table shared by the whole chunk
+struct State {
+  string name;
+  vector<std::pair<string, string>> properties;
+  bool solid; // Wether the block counts in the OCEAN_FLOOR heightmap
+};
+
+struct Chunk {
+  int32_t x, z;
+  bool post116;
+
+  vector<State> states;
+  std::map<string, uint16_t> index;
+
+  // The state of every block, indexed by (x, z, y)
+  vector<uint16_t> blocks;
+
+  Chunk(const int32_t x, const int32_t z, const bool post116)
+      : x(x), z(z), post116(post116), blocks(16 * 16 * HEIGHT, 0) {
+    intern("minecraft:air", {}, false);
+  }
+
+  uint16_t intern(const string &name,
+                  const vector<std::pair<string, string>> &properties = {},
+                  const bool solid = true) {
+    string key = name;
+    for (auto &property : properties)
+      key += "," + property.first + "=" + property.second;
+
+    auto found = index.find(key);
+    if (found != index.end())
+      return found->second;
+
+    states.push_back({name, properties, solid});
+    return index[key] = states.size() - 1;
+  }
+
+  uint16_t &at(const uint8_t bx, const uint8_t bz, const uint16_t y) {
+    return blocks[(bx + bz * 16) * HEIGHT + y];
+  }
+};
+
+uint16_t terrainHeight(const Options &options, const int64_t x,
+                       const int64_t z) {
+  switch (options.profile) {
+  case FLAT:
+    return 63;
+  case OCEAN:
+    return 22 + 20 * noise(options.seed, x, z, 48) +
+           5 * noise(options.seed, x, z, 8);
+  default:
+    return 44 + 40 * noise(options.seed, x, z, 64) +
+           14 * noise(options.seed, x, z, 16) +
+           3 * noise(options.seed, x, z, 4);
+  }
+}
+
+void tree(const Options &options, Chunk &chunk, const uint8_t bx,
+          const uint8_t bz, const uint16_t ground) {
+  const uint16_t top = ground + 5;
+  const uint16_t leaves = chunk.intern("minecraft:oak_leaves"),
+                 log = chunk.intern("minecraft:oak_log", {{"axis", "y"}});
+
+  if (top + 2 >= HEIGHT)
+    return;
+
+  for (int8_t dx = -2; dx <= 2; dx++)
+    for (int8_t dz = -2; dz <= 2; dz++)
+      for (uint16_t y = top - 2; y <= top + 1; y++)
+        if (abs(dx) + abs(dz) + (y > top ? 2 : 0) <= 3)
+          chunk.at(bx + dx, bz + dz, y) = leaves;
+
+  for (uint16_t y = ground + 1; y <= top; y++)
+    chunk.at(bx, bz, y) = log;
+}
+
+void building(const Options &options, Chunk &chunk, const uint16_t ground) {
+  const uint64_t seed = hash(options.seed, chunk.x, chunk.z, 1);
+  const uint16_t top = std::min(ground + 12 + int(seed % 48), HEIGHT - 2);
+
+  // Walls and floors made of a random mix of blocks and states, to build
+  // large palettes
+  for (uint8_t bx = 1; bx < 15; bx++)
+    for (uint8_t bz = 1; bz < 15; bz++)
+      for (uint16_t y = ground - 2; y <= top; y++) {
+        const bool wall = bx == 1 || bx == 14 || bz == 1 || bz == 14;
+        const bool floor = (y - ground) % 6 == 0;
+
+        if (!wall && !floor) {
+          chunk.at(bx, bz, y) = 0;
+          continue;
+        }
+
+        const uint64_t pick = hash(seed, bx, bz, y);
+        if (wall && !floor && (y - ground) % 6 == 3 && (bx + bz) % 3 == 0) {
+          chunk.at(bx, bz, y) = chunk.intern("minecraft:glass");
+          continue;
+        }
+
+        chunk.at(bx, bz, y) = chunk.intern(
+            buildingBlocks[pick % buildingBlocks.size()],
+            {{"variant", std::to_string((pick >> 16) % 12)}});
+      }
+}
+
+void generate(const Options &options, Chunk &chunk) {
+  const uint16_t air = 0, bedrock = chunk.intern("minecraft:bedrock"),
+                 stone = chunk.intern("minecraft:stone"),
+                 dirt = chunk.intern("minecraft:dirt"),
+                 grass = chunk.intern("minecraft:grass_block",
+                                      {{"snowy", "false"}}),
+                 sand = chunk.intern("minecraft:sand"),
+                 gravel = chunk.intern("minecraft:gravel"),
+                 water = chunk.intern("minecraft:water", {{"level", "0"}},
+                                      false),
+                 seagrass = chunk.intern("minecraft:seagrass", {}, false),
+                 plant = chunk.intern("minecraft:grass", {}, false),
+                 flower = chunk.intern("minecraft:poppy", {}, false),
+                 ore = chunk.intern("minecraft:iron_ore");
+
+  uint16_t heights[16][16];
+
+  for (uint8_t bx = 0; bx < 16; bx++)
+    for (uint8_t bz = 0; bz < 16; bz++) {
+      const int64_t x = int64_t(chunk.x) * 16 + bx,
+                    z = int64_t(chunk.z) * 16 + bz;
+      const uint16_t height = heights[bx][bz] = terrainHeight(options, x, z);
+
+      for (uint16_t y = 0; y < HEIGHT; y++) {
+        uint16_t &block = chunk.at(bx, bz, y);
+        const double random = unit(hash(options.seed, x, z, y));
+
+        if (y == 0)
+          block = bedrock;
+        else if (y + 3 < height)
+          block = random < 0.01 ? ore : stone;
+        else if (y < height)
+          block = options.profile == OCEAN ? gravel : dirt;
+        else if (y == height)
+          block = height < SEA_LEVEL ? sand : grass;
+        else if (y <= SEA_LEVEL)
+          block = (y == height + 1 && random < 0.15) ? seagrass : water;
+        else if (y == height + 1 && options.profile != FLAT)
+          block = random < 0.1 ? plant : random < 0.12 ? flower : air;
+        else
+          block = air;
+      }
+    }
+
+  // Hollow chunks have their underground emptied
+  if (options.profile == HOLLOW)
+    for (uint8_t bx = 0; bx < 16; bx++)
+      for (uint8_t bz = 0; bz < 16; bz++)
+        for (uint16_t y = 16; y < 48 && y + 4 < heights[bx][bz]; y++)
+          chunk.at(bx, bz, y) = air;
+
+  if (options.profile == BUILDS) {
+    uint16_t ground = 0;
+    for (uint8_t bx = 0; bx < 16; bx++)
+      for (uint8_t bz = 0; bz < 16; bz++)
+        ground = std::max(ground, heights[bx][bz]);
+
+    building(options, chunk, std::max(ground, uint16_t(SEA_LEVEL)) + 1);
+    return;
+  }
+
+  if (options.profile == FLAT || options.profile == OCEAN)
+    return;
+
+  // A few trees, kept inside the chunk
+  for (uint8_t bx = 2; bx < 14; bx++)
+    for (uint8_t bz = 2; bz < 14; bz++)
+      if (heights[bx][bz] > SEA_LEVEL &&
+          unit(hash(options.seed, chunk.x * 16 + bx, chunk.z * 16 + bz, -1)) <
+              0.008)
+        tree(options, chunk, bx, bz, heights[bx][bz]);
+}
+
+// Big, incompressible block entities making the chunk too big for its region
+void oversize(const Options &options, const Chunk &chunk, NBTWriter &nbt) {
+  const uint8_t entities = 24;
+  nbt.list("TileEntities", 10, entities);
+
+  for (uint8_t entity = 0; entity < entities; entity++) {
+    vector<uint8_t> payload(64 * 1024);
+    for (size_t i = 0; i < payload.size(); i += 8) {
+      const uint64_t value = hash(options.seed, chunk.x, chunk.z,
+                                  (int64_t(entity) << 32) | int64_t(i));
+      memcpy(&payload[i], &value, 8);
+    }
+
+    nbt.stringTag("id", "minecraft:chest");
+    nbt.intTag("x", chunk.x * 16 + entity % 16);
+    nbt.intTag("y", 1);
+    nbt.intTag("z", chunk.z * 16);
+    nbt.byteArray("Data", payload);
+    nbt.end();
+  }
+}
+
+bool isOversized(const Options &options, const Chunk &chunk) {
+  return options.profile == OVERSIZED &&
+         ((chunk.x == options.originX && chunk.z == options.originZ) ||
+          hash(options.seed, chunk.x, chunk.z, 2) % 64 == 0);
+}
+
+vector<uint8_t> serialize(const Options &options, Chunk &chunk) {
+  NBTWriter nbt;
+  const uint64_t hollowHash = hash(options.seed, chunk.x, chunk.z, 3);
+
+  nbt.compound("");
+  nbt.intTag("DataVersion", chunk.post116 ? VERSION_POST116 : VERSION_PRE116);
+  nbt.compound("Level");
+  nbt.intTag("xPos", chunk.x);
+  nbt.intTag("zPos", chunk.z);
+  nbt.stringTag("Status", "full");
+
+  // Build the sections, leaving out the empty ones above the terrain
+  vector<int8_t> ys;
+  vector<vector<uint16_t>> palettes, indexes;
+
+  for (int8_t sy = 0; sy < HEIGHT / 16; sy++) {
+    std::map<uint16_t, uint16_t> local;
+    vector<uint16_t> palette = {0}, section(4096);
+    local[0] = 0;
+
+    for (uint8_t y = 0; y < 16; y++)
+      for (uint8_t bz = 0; bz < 16; bz++)
+        for (uint8_t bx = 0; bx < 16; bx++) {
+          const uint16_t state = chunk.at(bx, bz, sy * 16 + y);
+          auto found = local.find(state);
+
+          if (found == local.end()) {
+            found = local.emplace(state, palette.size()).first;
+            palette.push_back(state);
+          }
+
+          section[bx + bz * 16 + y * 256] = found->second;
+        }
+
+    // Empty sections are skipped, except in hollow chunks where half of them
+    // are kept with only air in their palette
+    if (palette.size() == 1 &&
+        !(options.profile == HOLLOW && sy < 4 && hollowHash % 2))
+      continue;
+
+    ys.push_back(sy);
+    palettes.push_back(palette);
+    indexes.push_back(section);
+  }
+
+  // 1.16+ chunks also store an empty section under the world, for lighting
+  const bool lightSection = chunk.post116;
+  nbt.list("Sections", 10, ys.size() + lightSection);
+
+  if (lightSection) {
+    nbt.byteTag("Y", -1);
+    nbt.end();
+  }
+
+  for (size_t i = 0; i < ys.size(); i++) {
+    const uint8_t bits = std::max(
+        uint8_t(4), uint8_t(ceil(log2(double(palettes[i].size())))));
+
+    nbt.byteTag("Y", ys[i]);
+    nbt.list("Palette", 10, palettes[i].size());
+    for (auto state : palettes[i]) {
+      const State &block = chunk.states[state];
+      nbt.stringTag("Name", block.name);
+
+      if (!block.properties.empty()) {
+        nbt.compound("Properties");
+        for (auto &property : block.properties)
+          nbt.stringTag(property.first, property.second);
+        nbt.end();
+      }
+
+      nbt.end();
+    }
+
+    nbt.longArray("BlockStates", pack(indexes[i], bits, chunk.post116));
+    nbt.end();
+  }
+
+  // Heightmaps, storing for every column the height over the highest block:
+  // of any block, of a solid one, and of one stopping motion, leaves aside
+  vector<uint16_t> surface(256, 0), floor(256, 0), ground(256, 0);
+  for (uint8_t bx = 0; bx < 16; bx++)
+    for (uint8_t bz = 0; bz < 16; bz++) {
+      const uint16_t column = bx + bz * 16;
+
+      for (uint16_t y = HEIGHT;
+           y-- > 0 && !(floor[column] && ground[column]);) {
+        const uint16_t state = chunk.at(bx, bz, y);
+        const State &block = chunk.states[state];
+        if (!state)
+          continue;
+
+        const bool leaves = block.name.find("_leaves") != string::npos,
+                   fluid = block.name == "minecraft:water" ||
+                           block.name == "minecraft:seagrass";
+
+        if (!surface[column])
+          surface[column] = y + 1;
+
+        if (block.solid && !floor[column])
+          floor[column] = y + 1;
+
+        if (((block.solid && !leaves) || fluid) && !ground[column])
+          ground[column] = y + 1;
+      }
+    }
+
+  nbt.compound("Heightmaps");
+  nbt.longArray("WORLD_SURFACE", pack(surface, 9, chunk.post116));
+  nbt.longArray("OCEAN_FLOOR", pack(floor, 9, chunk.post116));
+  nbt.longArray("MOTION_BLOCKING_NO_LEAVES", pack(ground, 9, chunk.post116));
+  nbt.end();
+
+  if (isOversized(options, chunk))
+    oversize(options, chunk, nbt);
+
+  nbt.end(); // Level
+  nbt.end(); // Root
+
+  return nbt.data;
+}
+
+bool deflateChunk(const vector<uint8_t> &data, const bool gzip,
+                  vector<uint8_t> *output) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+
+  // The window bits select the gzip header and trailer instead of zlib's
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   gzip ? 16 + MAX_WBITS : MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+
+  output->resize(deflateBound(&stream, data.size()));
+  stream.next_in = const_cast<Bytef *>(data.data());
+  stream.avail_in = data.size();
+  stream.next_out = output->data();
+  stream.avail_out = output->size();
+
+  const int status = deflate(&stream, Z_FINISH);
+  output->resize(stream.total_out);
+  deflateEnd(&stream);
+
+  return status == Z_STREAM_END;
+}
+
+uint32_t readLE32(const uint8_t *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+
+void writeLE32(const uint32_t value, vector<uint8_t> *output) {
+  for (uint8_t shift = 0; shift < 32; shift += 8)
+    output->push_back(value >> shift);
+}
+
+// The 32 bit xxHash of some data, the checksum of the blocks of lz4-java
+uint32_t xxh32(const uint8_t *data, const size_t length, const uint32_t seed) {
+  const uint32_t P1 = 2654435761U, P2 = 2246822519U, P3 = 3266489917U,
+                 P4 = 668265263U, P5 = 374761393U;
+  auto rotate = [](const uint32_t x, const uint8_t r) {
+    return (x << r) | (x >> (32 - r));
+  };
+
+  const uint8_t *p = data, *const end = data + length;
+  uint32_t hash = seed + P5;
+
+  if (length >= 16) {
+    uint32_t lanes[4] = {seed + P1 + P2, seed + P2, seed, seed - P1};
+    for (; p + 16 <= end; p += 16)
+      for (uint8_t i = 0; i < 4; i++)
+        lanes[i] = rotate(lanes[i] + readLE32(p + i * 4) * P2, 13) * P1;
+
+    hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) +
+           rotate(lanes[3], 18);
+  }
+
+  hash += uint32_t(length);
+  for (; p + 4 <= end; p += 4)
+    hash = rotate(hash + readLE32(p) * P3, 17) * P4;
+  for (; p < end; p++)
+    hash = rotate(hash + *p * P5, 11) * P1;
+
+  hash = (hash ^ (hash >> 15)) * P2;
+  hash = (hash ^ (hash >> 13)) * P3;
+  return hash ^ (hash >> 16);
+}
+
+// Compress a block in the LZ4 format, greedily matching the 4 bytes found at
+// the last position with the same hash. Returns false if the block does not
+// get smaller.
+bool lz4Block(const uint8_t *data, const uint32_t length,
+              vector<uint8_t> *output) {
+  vector<int64_t> last(1 << 12, -1);
+  uint32_t position = 0, anchor = 0;
+  output->clear();
+
+  auto writeLength = [output](uint32_t value) {
+    for (; value >= 255; value -= 255)
+      output->push_back(255);
+    output->push_back(value);
+  };
+
+  // Sequences of literals and a match, the matches starting 12 bytes before
+  // the end of the block and stopping 5 bytes before it
+  while (position + 12 < length) {
+    const uint32_t hash = (readLE32(data + position) * 2654435761U) >> 20;
+    const int64_t candidate = last[hash];
+    last[hash] = position;
+
+    if (candidate < 0 || position - candidate > 0xffff ||
+        readLE32(data + candidate) != readLE32(data + position)) {
+      position++;
+      continue;
+    }
+
+    uint32_t match = 4;
+    while (position + match + 5 < length &&
+           data[candidate + match] == data[position + match])
+      match++;
+
+    const uint32_t literals = position - anchor,
+                   offset = position - candidate;
+    output->push_back(std::min(literals, 15U) << 4 |
+                      std::min(match - 4, 15U));
+    if (literals >= 15)
+      writeLength(literals - 15);
+    output->insert(output->end(), data + anchor, data + position);
+
+    output->push_back(offset);
+    output->push_back(offset >> 8);
+    if (match - 4 >= 15)
+      writeLength(match - 19);
+
+    position += match;
+    anchor = position;
+  }
+
+  // The last sequence only has literals
+  const uint32_t literals = length - anchor;
+  output->push_back(std::min(literals, 15U) << 4);
+  if (literals >= 15)
+    writeLength(literals - 15);
+  output->insert(output->end(), data + anchor, data + length);
+
+  return output->size() < length;
+}
+
+// Compress in blocks of 64 KiB, each with a header: the magic string, the
+// method and level, the compressed and decompressed sizes and the checksum.
+// Blocks not getting smaller are stored raw, and an empty block ends the
+// stream.
+void lz4(const vector<uint8_t> &data, vector<uint8_t> *output) {
+  const uint8_t raw = 0x10, compressed = 0x20, level = 6;
+  const uint32_t blockSize = 1 << (10 + level);
+  vector<uint8_t> block;
+  output->clear();
+
+  auto header = [output](const uint8_t method, const uint32_t length,
+                         const uint32_t size, const uint32_t checksum) {
+    const char *magic = "LZ4Block";
+    output->insert(output->end(), magic, magic + 8);
+    output->push_back(method | level);
+    writeLE32(length, output);
+    writeLE32(size, output);
+    writeLE32(checksum, output);
+  };
+
+  for (size_t start = 0; start < data.size(); start += blockSize) {
+    const uint8_t *in = data.data() + start;
+    const uint32_t size = std::min(size_t(blockSize), data.size() - start);
+    const uint32_t checksum = xxh32(in, size, 0x9747b28c) & 0x0fffffff;
+
+    if (lz4Block(in, size, &block)) {
+      header(compressed, block.size(), size, checksum);
+      output->insert(output->end(), block.begin(), block.end());
+    } else {
+      header(raw, size, size, checksum);
+      output->insert(output->end(), in, in + size);
+    }
+  }
+
+  header(raw, 0, 0, 0);
+}
+
+bool compress(const Compression compression, const vector<uint8_t> &data,
+              vector<uint8_t> *output) {
+  switch (compression) {
+  case GZIP:
+  case ZLIB:
+    return deflateChunk(data, compression == GZIP, output);
+  case NONE:
+    *output = data;
+    return true;
+  case LZ4:
+    lz4(data, output);
+    return true;
+  }
+
+  return false;
+}
+
+bool write(const path &file, const vector<uint8_t> &data) {
+  FILE *f = fopen(file.c_str(), "wb");
+
+  if (!f || fwrite(data.data(), 1, data.size(), f) != data.size()) {
+    fmt::print(stderr, "Error writing {}: {}\n", file.string(),
+               strerror(errno));
+    if (f)
+      fclose(f);
+    return false;
+  }
+
+  fclose(f);
+  return true;
+}
+
+bool writeRegion(const Options &options, const path &regionDir,
+                 const int32_t regionX, const int32_t regionZ,
+                 uint32_t *count) {
+  // Two sectors of header: the locations then the timestamps
+  vector<uint8_t> file(2 * SECTOR, 0), compressed;
+
+  for (uint16_t index = 0; index < REGIONSIZE * REGIONSIZE; index++) {
+    const int32_t x = regionX * REGIONSIZE + (index & 0x1f),
+                  z = regionZ * REGIONSIZE + (index >> 5);
+
+    if (x < options.originX || x >= options.originX + int32_t(options.size) ||
+        z < options.originZ || z >= options.originZ + int32_t(options.size))
+      continue;
+
+    const bool post116 = options.format == POST116 ||
+                         (options.format == MIXED && (x + z) % 2 == 0);
+
+    Chunk chunk(x, z, post116);
+    generate(options, chunk);
+
+    if (!compress(options.compression, serialize(options, chunk), &compressed))
+      return false;
+
+    uint8_t type = options.compression;
+    if (compressed.size() + 5 > MAX_SECTORS * SECTOR) {
+      // Too big for the region: the data goes in a separate file and the high
+      // bit of the type is set
+      if (!write(regionDir / fmt::format("c.{}.{}.mcc", x, z), compressed))
+        return false;
+
+      compressed.clear();
+      type |= 0x80;
+    }
+
+    const uint32_t offset = file.size() / SECTOR,
+                   length = compressed.size() + 1;
+    const uint8_t sectors = (length + 4 + SECTOR - 1) / SECTOR;
+
+    const uint8_t header[5] = {uint8_t(length >> 24), uint8_t(length >> 16),
+                               uint8_t(length >> 8), uint8_t(length), type};
+    file.insert(file.end(), header, header + 5);
+    file.insert(file.end(), compressed.begin(), compressed.end());
+    file.resize(size_t(offset + sectors) * SECTOR, 0);
+
+    file[index * 4] = offset >> 16;
+    file[index * 4 + 1] = offset >> 8;
+    file[index * 4 + 2] = offset;
+    file[index * 4 + 3] = sectors;
+
+    (*count)++;
+  }
+
+  return write(regionDir / fmt::format("r.{}.{}.mca", regionX, regionZ),
+               file);
+}
+
+bool isNumeric(const char *str) {
+  if (str[0] == '-' && str[1] != '\0') {
+    ++str;
+  }
+  while (*str != '\0') {
+    if (*str < '0' || *str > '9') {
+      return false;
+    }
+    ++str;
+  }
+  return true;
+}
+
+void printHelp(char *binary) {
+  fmt::print(stderr,
+             "Usage: {} <options> <Save directory>\n"
+             "  -profile NAME      flat, hills, ocean, builds, hollow or "
+             "oversized [hills]\n"
+             "  -version NAME      1.15, 1.16 or mixed [mixed]\n"
+             "  -origin X Z        coordinates of the first chunk [0 0]\n"
+             "  -size N            side of the square of chunks [32]\n"
+             "  -seed N            seed of the terrain [0]\n"
+             "  -compression NAME  gzip, zlib, none or lz4 [zlib]\n",
+             binary);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    if (i < argc - 2 && !strcmp(argv[i], "-profile") &&
+        profiles.count(argv[i + 1])) {
+      options.profile = profiles.at(argv[++i]);
+    } else if (i < argc - 2 && !strcmp(argv[i], "-version") &&
+               formats.count(argv[i + 1])) {
+      options.format = formats.at(argv[++i]);
+    } else if (i < argc - 3 && !strcmp(argv[i], "-origin") &&
+               isNumeric(argv[i + 1]) && isNumeric(argv[i + 2])) {
+      options.originX = atoi(argv[++i]);
+      options.originZ = atoi(argv[++i]);
+    } else if (i < argc - 2 && !strcmp(argv[i], "-size") &&
+               isNumeric(argv[i + 1]) && atoi(argv[i + 1]) > 0) {
+      options.size = atoi(argv[++i]);
+    } else if (i < argc - 2 && !strcmp(argv[i], "-seed") &&
+               isNumeric(argv[i + 1])) {
+      options.seed = strtoull(argv[++i], nullptr, 10);
+    } else if (i < argc - 2 && !strcmp(argv[i], "-compression") &&
+               compressions.count(argv[i + 1])) {
+      options.compression = compressions.at(argv[++i]);
+    } else if (i == argc - 1) {
+      options.save = argv[i];
+    } else {
+      printHelp(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.save.empty()) {
+    printHelp(argv[0]);
+    return 1;
+  }
+
+  const path regionDir = options.save / "region";
+  std::error_code error;
+  std::filesystem::create_directories(regionDir, error);
+
+  if (error) {
+    fmt::print(stderr, "Error creating {}: {}\n", regionDir.string(),
+               error.message());
+    return 1;
+  }
+
+  const int32_t minRegionX = floorDiv(options.originX, REGIONSIZE),
+                minRegionZ = floorDiv(options.originZ, REGIONSIZE),
+                maxRegionX = floorDiv(
+                    int64_t(options.originX) + options.size - 1, REGIONSIZE),
+                maxRegionZ = floorDiv(
+                    int64_t(options.originZ) + options.size - 1, REGIONSIZE);
+  uint32_t count = 0;
+
+  for (int32_t regionX = minRegionX; regionX <= maxRegionX; regionX++)
+    for (int32_t regionZ = minRegionZ; regionZ <= maxRegionZ; regionZ++)
+      if (!writeRegion(options, regionDir, regionX, regionZ, &count))
+        return 1;
+
+  fmt::print("Generated {} chunks in {}\n", count, regionDir.string());
+  return 0;
+}
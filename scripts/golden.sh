@@ -0,0 +1,138 @@
+#!/bin/bash
+# Golden image regression test
+# Renders synthetic worlds in every orientation, with and without shading,
+# with several split and thread counts, and checks the images against the
+# hashes stored in golden.txt. The images must not depend on the number of
+# threads used. The time taken by every render is saved as csv.
+#
+# Usage: ./golden.sh [-update] [-mcmap BINARY] [-threads "1 4"] [-timings FILE]
+# Run `make` at the root and in this directory first.
+
+SCRIPTS=$(cd "$(dirname "$0")" && pwd)
+MCMAP=$SCRIPTS/../mcmap
+GOLDEN=$SCRIPTS/golden.txt
+THREADS="1 4"
+SPLITS="1 2 4"
+UPDATE=0
+
+TIMINGS=golden-timings.csv
+WORK=$(mktemp -d)
+
+while [ $# -gt 0 ]; do
+  case $1 in
+  -update) UPDATE=1 ;;
+  -mcmap) MCMAP=$2; shift ;;
+  -threads) THREADS=$2; shift ;;
+  -timings) TIMINGS=$2; shift ;;
+  *)
+    sed -n '8p' "$0" | cut -c3-
+    exit 1
+    ;;
+  esac
+  shift
+done
+
+for tool in "$MCMAP" "$SCRIPTS/generateWorld" "$SCRIPTS/canvasHash"; do
+  if [ ! -x "$tool" ]; then
+    echo "Missing $tool, build it first" >&2
+    exit 1
+  fi
+done
+
+# The worlds rendered, as: name, the generator's options, then the options of
+# the renders if any
+WORLDS=(
+  "hills:-profile hills -version mixed -origin -6 -6 -size 12"
+  "ocean:-profile ocean -version 1.16 -size 6"
+  "builds:-profile builds -version mixed -size 4"
+  "hollow:-profile hollow -version 1.15 -origin -2 -2 -size 5"
+  "oversized:-profile oversized -version 1.16 -size 3"
+  "holed:-profile ocean -version 1.16 -size 6:-select $WORK/holed.json"
+  "gzip:-profile hills -version 1.15 -size 3 -compression gzip"
+  "uncompressed:-profile builds -version 1.16 -size 3 -compression none"
+  "lz4:-profile oversized -version mixed -size 3 -compression lz4"
+)
+
+# The holed world is drawn without three chunks in its middle, showing the
+# sides of the chunks around them
+chunks=""
+for x in 0 1 2 3 4 5; do
+  for z in 0 1 2 3 4 5; do
+    case "$x $z" in
+    "2 2" | "3 2" | "2 3") continue ;;
+    esac
+    chunks="$chunks${chunks:+, }[$x, $z]"
+  done
+done
+echo "{\"chunks\": [$chunks]}" >"$WORK/holed.json"
+
+for world in "${WORLDS[@]}"; do
+  generator=${world#*:}
+  "$SCRIPTS/generateWorld" ${generator%%:*} "$WORK/${world%%:*}" >/dev/null ||
+    exit 1
+done
+
+RESULTS=$WORK/results.txt
+FAILED=0
+echo "world,orientation,shading,splits,threads,seconds" >"$TIMINGS"
+
+for world in "${WORLDS[@]}"; do
+  name=${world%%:*}
+  options=${world#*:}
+  options=${options#"${options%%:*}"}
+  for orientation in nw sw ne se; do
+    for shading in "" "-shading"; do
+      for splits in $SPLITS; do
+        key="$name $orientation ${shading:-flat} $splits"
+        reference=""
+
+        for threads in $THREADS; do
+          start=$(date +%s.%N)
+          OMP_NUM_THREADS=$threads "$MCMAP" -$orientation $shading \
+            ${options#:} -splits $splits -file "$WORK/out.png" "$WORK/$name" \
+            >/dev/null 2>&1
+          status=$?
+          end=$(date +%s.%N)
+
+          echo "$name,$orientation,${shading:-flat},$splits,$threads,$start,$end" |
+            awk -F, -v OFS=, '{ print $1, $2, $3, $4, $5, $7 - $6 }' >>"$TIMINGS"
+
+          if [ $status -ne 0 ]; then
+            echo "FAILED $key with $threads threads: exit status $status"
+            FAILED=1
+            continue
+          fi
+
+          hash=$("$SCRIPTS/canvasHash" "$WORK/out.png")
+
+          # Every thread count must give the same image
+          if [ -z "$reference" ]; then
+            reference=$hash
+            echo "$key $hash" >>"$RESULTS"
+          elif [ "$hash" != "$reference" ]; then
+            echo "NON DETERMINISTIC $key: $threads threads gave $hash, expected $reference"
+            FAILED=1
+          fi
+        done
+      done
+    done
+  done
+done
+
+if [ $UPDATE -eq 1 ]; then
+  cp "$RESULTS" "$GOLDEN"
+  echo "Updated $GOLDEN"
+elif ! diff "$GOLDEN" "$RESULTS" >"$WORK/diff.txt"; then
+  echo "Images differing from $GOLDEN (< expected, > rendered):"
+  cat "$WORK/diff.txt"
+  FAILED=1
+fi
+
+if [ $FAILED -eq 0 ]; then
+  echo "All $(wc -l <"$RESULTS") configurations match"
+fi
+
+echo "Timings saved in $TIMINGS"
+rm -fr "$WORK"
+
+exit $FAILED
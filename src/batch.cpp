@@ -0,0 +1,174 @@
+#include "./batch.h"
+#include "./logger.h"
+#include "./profiler.h"
+#include "./render.h"
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+bool Batch::jobArguments(const json &job, const std::filesystem::path &base,
+                         std::vector<std::string> *arguments) {
+  // The first argument is the binary name, skipped by the parser
+  arguments->push_back("mcmap");
+
+  if (!job.contains("world") || !job.contains("output")) {
+    logger::error("A job needs a world and an output\n");
+    return false;
+  }
+
+  arguments->push_back("-file");
+  arguments->push_back((base / job["output"].get<std::string>()).string());
+
+  if (job.contains("dimension")) {
+    arguments->push_back("-dimension");
+    arguments->push_back(job["dimension"].get<std::string>());
+  }
+
+  for (auto bound : {"from", "to"})
+    if (job.contains(bound)) {
+      auto coordinates = job[bound].get<std::pair<int32_t, int32_t>>();
+      arguments->push_back(std::string("-") + bound);
+      arguments->push_back(std::to_string(coordinates.first));
+      arguments->push_back(std::to_string(coordinates.second));
+    }
+
+  for (auto bound : {"min", "max"})
+    if (job.contains(bound)) {
+      arguments->push_back(std::string("-") + bound);
+      arguments->push_back(std::to_string(job[bound].get<int>()));
+    }
+
+  if (job.contains("orientation")) {
+    const std::string orientation = job["orientation"].get<std::string>();
+
+    if (orientation != "nw" && orientation != "ne" && orientation != "se" &&
+        orientation != "sw") {
+      logger::error("Invalid orientation {}\n", orientation);
+      return false;
+    }
+
+    arguments->push_back("-" + orientation);
+  }
+
+  if (job.contains("options"))
+    for (auto &option : job["options"])
+      arguments->push_back(option.get<std::string>());
+
+  // The world comes last, like on the command line
+  arguments->push_back((base / job["world"].get<std::string>()).string());
+
+  return true;
+}
+
+bool Batch::run(const std::filesystem::path &file,
+                const Colors::Palette &colors) {
+  json data;
+
+  FILE *f = fopen(file.c_str(), "r");
+  if (!f) {
+    logger::error("Could not open job file {}: {}\n", file.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  try {
+    data = json::parse(f);
+  } catch (const nlohmann::detail::parse_error &err) {
+    logger::error("Parsing job file {} failed: {}\n", file.c_str(),
+                  err.what());
+    fclose(f);
+    return false;
+  }
+
+  fclose(f);
+
+  if (!data.contains("jobs") || !data["jobs"].is_array()) {
+    logger::error("Invalid job file {}: no list of jobs\n", file.c_str());
+    return false;
+  }
+
+  // Parse every job like a command line, the region directories being
+  // scanned once for all the jobs
+  Settings::ScanCache scans;
+  std::vector<Settings::WorldOptions> jobs(data["jobs"].size());
+  std::vector<bool> valid(jobs.size(), false);
+
+  for (size_t index = 0; index < jobs.size(); index++) {
+    std::vector<std::string> arguments;
+    std::vector<char *> argv;
+
+    try {
+      if (!jobArguments(data["jobs"][index], file.parent_path(),
+                        &arguments)) {
+        logger::error("Invalid job {}\n", index);
+        continue;
+      }
+    } catch (const nlohmann::detail::exception &err) {
+      logger::error("Invalid job {}: {}\n", index, err.what());
+      continue;
+    }
+
+    for (auto &argument : arguments)
+      argv.push_back(&argument[0]);
+
+    if (!Settings::parseArgs(argv.size(), argv.data(), &jobs[index], &scans) ||
+        jobs[index].mode != Settings::RENDER) {
+      logger::error("Invalid options in job {}\n", index);
+      continue;
+    }
+
+    valid[index] = true;
+  }
+
+  // Render the jobs on the same regions one after the other, from the
+  // north-west, for the chunks they share to be found in the cache
+  std::vector<size_t> order(jobs.size());
+  std::iota(order.begin(), order.end(), 0);
+
+  std::stable_sort(order.begin(), order.end(), [&jobs](size_t a, size_t b) {
+    const Coordinates &first = jobs[a].boundaries,
+                      &second = jobs[b].boundaries;
+    return std::make_tuple(jobs[a].regionDir(), REGION(CHUNK(first.minZ)),
+                           REGION(CHUNK(first.minX))) <
+           std::make_tuple(jobs[b].regionDir(), REGION(CHUNK(second.minZ)),
+                           REGION(CHUNK(second.minX)));
+  });
+
+  // The palettes are loaded once per color file
+  std::map<std::filesystem::path, Colors::Palette> palettes;
+  size_t done = 0, failed = 0;
+
+  for (size_t index : order) {
+    if (!valid[index]) {
+      failed++;
+      continue;
+    }
+
+    Settings::WorldOptions &job = jobs[index];
+    logger::info("Job {}/{}: {}\n", ++done, jobs.size(), job.outFile.c_str());
+
+    const Colors::Palette *palette = &colors;
+    if (!job.colorFile.empty()) {
+      if (!palettes.count(job.colorFile))
+        Colors::load(job.colorFile, &palettes[job.colorFile]);
+      palette = &palettes[job.colorFile];
+    }
+
+    try {
+      if (!Render::render(job, *palette))
+        failed++;
+    } catch (const std::exception &err) {
+      logger::error("Job {} failed: {}\n", index, err.what());
+      failed++;
+    }
+
+    // A job's profile only holds its own timings
+    Profiler::reset();
+  }
+
+  if (failed)
+    logger::error("{} of {} jobs failed\n", failed, jobs.size());
+
+  return !failed;
+}
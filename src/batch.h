@@ -0,0 +1,46 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "./colors.h"
+#include "./settings.h"
+#include <filesystem>
+#include <json.hpp>
+#include <string>
+#include <vector>
+
+using nlohmann::json;
+
+// Batch rendering
+// A job file lists maps to render in a single process, sharing the region
+// cache, the decompressed chunks, the color palettes and the scans of the
+// region directories. It is a json object holding a list of jobs:
+//
+// {
+//   "jobs": [
+//     {
+//       "world": "saves/World",           // Path to the save
+//       "output": "spawn.png",            // Image to write
+//       "dimension": "the_nether",        // Optional, overworld by default
+//       "from": [X, Z], "to": [X, Z],     // Optional bounds, in blocks
+//       "min": 0, "max": 255,             // Optional height bounds
+//       "orientation": "nw",              // Optional, nw, ne, se or sw
+//       "options": ["-shading"]           // Other command line options
+//     }
+//   ]
+// }
+//
+// Relative paths are relative to the job file. Jobs are reordered to render
+// the ones using the same regions one after the other, while their chunks are
+// still in the cache.
+namespace Batch {
+
+// Translate a job into command line arguments
+bool jobArguments(const json &, const std::filesystem::path &,
+                  std::vector<std::string> *);
+
+// Render all the jobs of the file. Returns false if a job failed.
+bool run(const std::filesystem::path &, const Colors::Palette &);
+
+} // namespace Batch
+
+#endif // BATCH_H_
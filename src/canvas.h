@@ -1,98 +1,332 @@
 #ifndef CANVAS_H_
 #define CANVAS_H_
 
+#include "./heatmap.h"
 #include "./helper.h"
+#include "./markers.h"
 #include "./worldloader.h"
+#include <array>
+#include <functional>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #define CHANSPERPIXEL 4
 #define BYTESPERCHAN 1
 #define BYTESPERPIXEL 4
 
-// Isometric canvas
-// This structure holds the final bitmap data, a 2D array of pixels. It is
-// created with a set of 3D coordinates, and translate every block drawn into a
-// 2D position.
-struct IsometricCanvas {
-  bool shading;
+// The position of a cell of the world on the two axes of the images of an
+// orientation, the cell being given by its coordinates divided by the size of
+// the cells. The first axis goes to the right of the image, the second one
+// down in the top-down view and to the left in the isometric view.
+inline void orientCell(const Orientation o, const int32_t x, const int32_t z,
+                       int32_t *u, int32_t *v) {
+  *u = x, *v = z;
 
-  Coordinates map;          // The coordinates describing the 3D map
-  uint32_t sizeX, sizeZ;    // The size of the 3D map
-  uint8_t offsetX, offsetZ; // Offset of the first block in the first chunk
+  switch (o) {
+  case NW:
+    break;
+  case NE:
+    *u = z, *v = -x;
+    break;
+  case SE:
+    *u = -x, *v = -z;
+    break;
+  case SW:
+    *u = -z, *v = x;
+    break;
+  }
+}
+
+// Canvas
+// This structure holds the final bitmap data, a 2D array of pixels, and the
+// methods common to every view of the terrain: cropping the empty areas, and
+// exporting the pixels. The views inherit from it and decide the size of the
+// bitmap, then how blocks translate into pixels.
+struct Canvas {
+  // Provides the buffer of a canvas of the given width and height, owned by
+  // the caller and already empty, or nullptr to let the canvas allocate its
+  // own
+  typedef std::function<uint8_t *(uint32_t, uint32_t)> Allocator;
+
+  Coordinates map; // The coordinates describing the 3D map
 
   uint32_t width, height; // Bitmap width and height
   uint16_t padding;       // Padding inside the image
-  uint8_t heightOffset;   // Offset for block rendering
 
   uint8_t *bytesBuffer; // The buffer where pixels are written
   uint64_t size;        // The size of the buffer
+  bool ownsBuffer;      // Wether the buffer is freed with the canvas
 
-  uint64_t nXChunks, nZChunks;
+  // The rectangle holding every pixel drawn, grown by the views as they draw
+  // and merged with the sub-canvases, for cropping without reading the
+  // pixels back. It is empty as long as left is past right.
+  uint32_t drawnLeft, drawnTop, drawnRight, drawnBottom;
 
-  Colors::Palette palette;         // The colors to use when drawing
-  Colors::Block water, beaconBeam; // Cached colors for easy access
+  Allocator allocator;
 
-  // Those arrays are chunk-based values, that get overwritten at every new
-  // chunk
-  uint8_t numBeacons = 0, beacons[256];
-  uint8_t localMarkers = 0, totalMarkers = 0;
-  // Markers inside the chunk:
-  // 8 bits for the index inside markers, 4 bits for x, 4 bits for z
-  uint16_t chunkMarkers[256];
-  Colors::Marker (*markers)[256];
+  Canvas(const Terrain::Coordinates &coords, const uint16_t padding,
+         const Allocator &allocator = nullptr)
+      : map(coords), width(0), height(0), padding(padding),
+        bytesBuffer(nullptr), size(0), ownsBuffer(false),
+        drawnLeft(UINT32_MAX), drawnTop(UINT32_MAX), drawnRight(0),
+        drawnBottom(0), allocator(allocator) {}
 
-  float *brightnessLookup;
+  virtual ~Canvas() {
+    if (ownsBuffer)
+      delete[] bytesBuffer;
+  }
 
-  IsometricCanvas(const Terrain::Coordinates &coords,
-                  const Colors::Palette &colors, const uint16_t padding = 0);
+  // Get an empty buffer, once the width and height are known. Only the
+  // buffers the canvas allocates itself are cleared here.
+  void allocate() {
+    Profiler::Timer timer(Profiler::ALLOCATE);
 
-  ~IsometricCanvas() { delete[] bytesBuffer; }
+    size = uint64_t(width) * height * BYTESPERPIXEL;
+    bytesBuffer = allocator ? allocator(width, height) : nullptr;
+    ownsBuffer = !bytesBuffer;
 
-  void setMarkers(uint8_t n, Colors::Marker (*array)[256]) {
-    totalMarkers = n;
-    markers = array;
+    if (ownsBuffer) {
+      bytesBuffer = new uint8_t[size];
+      memset(bytesBuffer, 0, size);
+    }
   }
 
+  inline uint8_t *pixel(uint32_t x, uint32_t y) {
+    return &bytesBuffer[(x + uint64_t(y) * width) * BYTESPERPIXEL];
+  }
+
+  // Grow the drawn rectangle to hold the given one, corners included
+  inline void markDrawn(const uint32_t left, const uint32_t top,
+                        const uint32_t right, const uint32_t bottom) {
+    drawnLeft = std::min(drawnLeft, left);
+    drawnTop = std::min(drawnTop, top);
+    drawnRight = std::max(drawnRight, right);
+    drawnBottom = std::max(drawnBottom, bottom);
+  }
+
+  bool drawn() const { return drawnLeft <= drawnRight; }
+
+  // The position of the first pixel of the canvas in the image of the whole
+  // world, in which the top left corner of the cell 0 0 at the height 0 is at
+  // the origin. A canvas not drawn by a view is an image of its own.
+  virtual void imageOrigin(int64_t *x, int64_t *y) const { *x = *y = 0; }
+
   // Cropping methods
   // Those getters return a value inferior to the actual underlying values
   // leaving out empty areas, to essentially 'crop' the canvas to fit perfectly
-  // the image
+  // the image. They only look at the drawn rectangle.
   uint32_t getCroppedWidth() const;
   uint32_t getCroppedHeight() const;
 
   uint64_t getCroppedSize() const {
-    return getCroppedWidth() * getCroppedHeight();
+    return uint64_t(getCroppedWidth()) * getCroppedHeight() * BYTESPERPIXEL;
   }
+  // The first pixel of the cropped view, as an offset from the beginning of
+  // the buffer. Its lines are still `width` pixels apart.
   uint64_t getCroppedOffset() const;
 
-  // Line indexes
+  // Line and column indexes, padding included
   uint32_t firstLine() const;
   uint32_t lastLine() const;
+  uint32_t firstColumn() const;
+  uint32_t lastColumn() const;
+};
+
+// Canvas buffer
+// A buffer kept by a thread for the canvases it draws one after the other,
+// instead of allocating, faulting in and clearing a new one for each. Only
+// the rectangle drawn on the last canvas is cleared for the next one, the
+// rest of the buffer being still empty.
+struct CanvasBuffer {
+  std::vector<uint8_t> bytes;
+
+  // The width of the last canvas, and the rectangle of its pixels to clear,
+  // empty as long as left is past right
+  uint32_t width, dirtyLeft, dirtyTop, dirtyRight, dirtyBottom;
+
+  CanvasBuffer()
+      : width(0), dirtyLeft(UINT32_MAX), dirtyTop(UINT32_MAX), dirtyRight(0),
+        dirtyBottom(0) {}
+
+  // Hand the buffer out, empty, to a canvas of the given size. Until it is
+  // released, the whole canvas is cleared for the next one.
+  uint8_t *take(const uint32_t width, const uint32_t height);
+  // Keep only the rectangle drawn on the canvas to clear, once it is done
+  // with the buffer
+  void release(const Canvas &);
+
+  Canvas::Allocator allocator() {
+    return [this](const uint32_t width, const uint32_t height) {
+      return take(width, height);
+    };
+  }
+};
+
+// Isometric canvas
+// The isometric view of the terrain. It is created with a set of 3D
+// coordinates, and translate every block drawn into a 2D position.
+struct IsometricCanvas : public Canvas {
+  bool shading;
+
+  uint32_t sizeX, sizeZ;    // The size of the 3D map
+  uint8_t offsetX, offsetZ; // Offset of the first block in the first chunk
+
+  uint8_t heightOffset; // Offset for block rendering
+  uint8_t scale;        // Blocks are drawn by cells of 2^scale on every axis
+
+  uint64_t nXChunks, nZChunks;
+
+  Colors::Palette palette;         // The colors to use when drawing
+  Colors::Block water, beaconBeam; // Cached colors for easy access
+
+  // Those arrays are chunk-based values, that get overwritten at every new
+  // chunk
+  uint8_t numBeacons = 0, beacons[256];
+  // The columns of the chunk inside the map, in canvas order
+  uint8_t columnMinX, columnMaxX, columnMinZ, columnMaxZ;
+  // The lowest block to draw in every column, if only the surface is drawn
+  const uint8_t *columnFloors;
+  // The columns of the chunks in front of the chunk facing its front edges,
+  // along z then x in canvas order: their lowest block drawn and the height
+  // over their highest block, 0 if their chunk is not loaded
+  uint8_t frontFloors[2][16];
+  uint16_t frontTops[2][16];
+  // The chunks of the map not loaded in front of the chunk, close enough for
+  // the sides of its runs of translucent blocks to be seen: the canvas
+  // position of their first block
+  uint8_t numFrontHoles;
+  int64_t frontHoles[16][2];
+  // The runs of translucent blocks reaching the top of the last section
+  // drawn, by column in canvas order: their block, the height of their top,
+  // the layers skipped and the ones drawn over them
+  Colors::Block *runBlocks[256];
+  int16_t runTops[256];
+  uint8_t runSkipped[256], runDrawn[256], runSection;
+
+  // The sections of the chunk, and the colors of their palettes, looked up
+  // when a block of the section is needed
+  struct SectionColors {
+    bool resolved;
+    std::vector<Colors::Block *> colors;
+    const std::vector<int64_t> *states;
+    uint32_t bitLength;
+  } sectionColors[16];
+  const std::vector<NBT> *chunkSections;
+  sectionInterpreter interpreter;
+
+  // The markers to draw, and the beams of the ones inside the map: their
+  // column, the height of the ground under them and their color. Beams are
+  // merged with the canvas, and drawn over the final canvas' terrain.
+  const Markers::Store *markers = nullptr;
+  struct Beam {
+    int32_t x, z;
+    uint16_t ground;
+    const Colors::Block *color;
+  };
+  std::vector<Beam> beams;
+
+  float *brightnessLookup;
+
+  // Debug statistics on the drawing, only recorded when enabled
+  Heatmap::Recorder *heatmap = nullptr;
+
+  // The canvas is tall enough for the blocks up to `top`. Beams go up to the
+  // top of the 13th section whatever the terrain, so a canvas drawing them
+  // must reach it.
+  IsometricCanvas(const Terrain::Coordinates &coords,
+                  const Colors::Palette &colors, const uint16_t padding = 0,
+                  const uint8_t scale = 0, const Allocator &allocator = nullptr,
+                  const uint8_t top = MAX_TERRAIN_HEIGHT);
+
+  ~IsometricCanvas() { delete heatmap; }
+
+  void enableHeatmap() { heatmap = new Heatmap::Recorder(width, height); }
+
+  void imageOrigin(int64_t *, int64_t *) const override;
+
+  void setMarkers(const Markers::Store *store) { markers = store; }
 
   // Merging methods
+  // The templated versions are specialized for each orientation, and called
+  // from the untemplated entrypoint
   void merge(const IsometricCanvas &subCanvas);
-  uint64_t calcAnchor(const IsometricCanvas &subCanvas);
+  template <Orientation o> void merge(const IsometricCanvas &subCanvas);
+  template <Orientation o> uint64_t calcAnchor(const IsometricCanvas &);
 
   // Drawing methods
   // Helpers for position lookup
-  void orientChunk(int32_t &x, int32_t &z);
-  void orientSection(uint8_t &x, uint8_t &z);
-  inline uint8_t *pixel(uint32_t x, uint32_t y) {
-    return &bytesBuffer[(x + y * width) * BYTESPERPIXEL];
-  }
+  template <Orientation o> void orientChunk(int32_t &x, int32_t &z);
+  template <Orientation o> void canvasChunk(int32_t &x, int32_t &z);
+  template <Orientation o> void orientSection(uint8_t &x, uint8_t &z);
+  template <Orientation o> void canvasSection(uint8_t &x, uint8_t &z);
+  template <Orientation o>
+  void orientBounds(const uint8_t, const uint8_t, const uint8_t,
+                    const uint8_t);
 
   // Drawing entrypoints
+  // The orientation is dispatched once in `renderTerrain`, the rest of the
+  // rendering path being instantiated for every orientation
   void renderTerrain(const Terrain::Data &);
+  template <Orientation o> void renderTerrain(const Terrain::Data &);
+  template <Orientation o>
   void renderChunk(const Terrain::Data &, const int64_t, const int64_t);
+  template <Orientation o>
   void renderSection(const NBT &, const int64_t, const int64_t, const uint8_t,
-                     sectionInterpreter);
+                     sectionDecoder);
+  // Draw a decoded section at a reduced scale, a block for every cell, from
+  // its blocks and the blocks to draw in every column
+  template <Orientation o>
+  void renderCells(const uint16_t *, const uint16_t *, Colors::Block *const *,
+                   const std::vector<NBT> *, const uint16_t, const uint16_t,
+                   const int64_t, const int64_t, const uint8_t);
   // Draw a block from virtual coords in the canvas
-  void renderBlock(Colors::Block *, const uint32_t, const uint32_t,
+  void renderBlock(const Colors::Block *, const uint32_t, const uint32_t,
                    const uint32_t, const NBT &metadata);
 
+  // The color of a block of a section of the chunk, from its coordinates in
+  // the section, or nullptr if it cannot be read
+  Colors::Block *sectionBlock(const uint8_t, const uint8_t, const uint8_t,
+                              const uint8_t);
+
   // Empty section with only beams
   void renderBeamSection(const int64_t, const int64_t, const uint8_t);
 
+  // Find the beams of the markers of a chunk, from the current chunk's
+  // sections
+  void findBeams(const int32_t, const int32_t, const uint8_t);
+  // Draw the beams over the terrain, from the back of the map
+  void renderBeams();
+  template <Orientation o> void renderBeams();
+
+  // Sections made of a single block look the same wherever they are: they are
+  // drawn once in a sprite, then copied. Blocks blending with what is under
+  // them have no sprite.
+  struct Sprite {
+    bool valid;
+    std::vector<uint8_t> pixels;
+    // The runs of pixels drawn: line, first column and length
+    std::vector<std::array<uint16_t, 3>> runs;
+    // The rectangle drawn: left, top, right and bottom
+    std::array<uint32_t, 4> drawn;
+  };
+
+  // Sprites by block and properties, and section height when shading
+  std::unordered_map<std::string, Sprite> sprites;
+
+  // Draw a section made of a single block from its sprite, drawn on the first
+  // occurrence. Returns false if the block has no sprite.
+  bool drawSprite(const Colors::Block *, const NBT &, const int64_t,
+                  const int64_t, const uint8_t);
+
+  // The position in the image of a block, from its coordinates in the canvas
+  void blockPosition(const uint32_t, const uint32_t, const uint32_t,
+                     uint32_t *, uint32_t *);
+  // Draw a block at a position in the image, shaded by its height
+  void drawBlock(const Colors::Block *, const uint32_t, const uint32_t,
+                 const uint32_t, const NBT &);
+
   // This obscure typedef allows to create a member function pointer array
   // (ouch) to render different block types without a switch case
   typedef void (IsometricCanvas::*drawer)(const uint32_t, const uint32_t,
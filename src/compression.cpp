@@ -0,0 +1,672 @@
+/**
+ * This file contains the decompressors of the chunk data, and a deflate
+ * decoder working on the whole stream at once
+ */
+
+#include "./compression.h"
+#include "./logger.h"
+#include <cstring>
+#include <zlib.h>
+
+namespace Compression {
+
+namespace {
+
+//  ____            _ _
+// |  _ \  ___  ___| (_)_ __   ___
+// | | | |/ _ \/ __| | | '_ \ / _ \.
+// | |_| |  __/ (__| | | | | |  __/
+// |____/ \___|\___|_|_|_| |_|\___|
+//
+// The Huffman codes of the deflate blocks are decoded with tables: the next
+// bits of the input index the table, and the entry gives the symbol and the
+// length of its code. Codes longer than the bits of the table point to a
+// subtable, indexed by their remaining bits.
+
+enum EntryType { LITERAL, LENGTH, END, SUBTABLE, INVALID };
+
+// An entry holds, from the lowest bits: the length of the code (4 bits), the
+// number of extra bits to read after it (4 bits), its type (8 bits) and its
+// value (16 bits). For subtable pointers, the extra bits are the bits of the
+// subtable and the value its position.
+inline uint32_t entry(const uint16_t value, const uint8_t type,
+                      const uint8_t extra) {
+  return uint32_t(value) << 16 | uint32_t(type) << 8 | uint32_t(extra) << 4;
+}
+
+inline uint8_t entryBits(const uint32_t e) { return e & 0x0f; }
+inline uint8_t entryExtra(const uint32_t e) { return (e >> 4) & 0x0f; }
+inline uint8_t entryType(const uint32_t e) { return (e >> 8) & 0xff; }
+inline uint16_t entryValue(const uint32_t e) { return e >> 16; }
+
+const uint8_t LITLEN_BITS = 10, DIST_BITS = 8, PRECODE_BITS = 7;
+
+// Large enough for the primary table and the subtables of any code
+const uint32_t LITLEN_SIZE = 2048, DIST_SIZE = 1024,
+               PRECODE_SIZE = 1 << PRECODE_BITS;
+
+// The values of the symbols of every alphabet
+struct Alphabets {
+  uint32_t litlen[288], dist[32], precode[19];
+
+  Alphabets() {
+    static const uint16_t lengthBase[29] = {
+        3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                            1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                            4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distBase[30] = {
+        1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t distExtra[30] = {0, 0, 0,  0,  1,  1,  2,  2,
+                                          3, 3, 4,  4,  5,  5,  6,  6,
+                                          7, 7, 8,  8,  9,  9,  10, 10,
+                                          11, 11, 12, 12, 13, 13};
+
+    for (uint16_t symbol = 0; symbol < 288; symbol++) {
+      if (symbol < 256)
+        litlen[symbol] = entry(symbol, LITERAL, 0);
+      else if (symbol == 256)
+        litlen[symbol] = entry(0, END, 0);
+      else if (symbol < 286)
+        litlen[symbol] = entry(lengthBase[symbol - 257], LENGTH,
+                               lengthExtra[symbol - 257]);
+      else
+        litlen[symbol] = entry(0, INVALID, 0);
+    }
+
+    for (uint16_t symbol = 0; symbol < 32; symbol++)
+      dist[symbol] = symbol < 30 ? entry(distBase[symbol], LENGTH,
+                                         distExtra[symbol])
+                                 : entry(0, INVALID, 0);
+
+    for (uint16_t symbol = 0; symbol < 19; symbol++)
+      precode[symbol] = entry(symbol, LITERAL, 0);
+  }
+};
+
+const Alphabets alphabets;
+
+// Build the decoding table of a canonical Huffman code, from the lengths of
+// the codes of its symbols. Returns false if the code is invalid.
+bool buildTable(const uint8_t *lengths, const uint16_t count,
+                const uint32_t *symbols, const uint8_t bits, uint32_t *table,
+                const uint32_t size) {
+  uint16_t counts[16] = {0}, offsets[16] = {0}, sorted[288];
+
+  for (uint16_t symbol = 0; symbol < count; symbol++)
+    counts[lengths[symbol]]++;
+  counts[0] = 0;
+
+  // Check the codes fit in the code space; it may not be filled when a
+  // single code is used
+  int32_t left = 1;
+  for (uint8_t length = 1; length < 16; length++) {
+    left = (left << 1) - counts[length];
+    if (left < 0)
+      return false;
+  }
+
+  const bool incomplete = left > 0;
+  if (incomplete)
+    for (uint32_t i = 0; i < (1u << bits); i++)
+      table[i] = entry(0, INVALID, 0);
+
+  // Sort the symbols by length of their code, then by value
+  for (uint8_t length = 1; length < 15; length++)
+    offsets[length + 1] = offsets[length] + counts[length];
+  for (uint16_t symbol = 0; symbol < count; symbol++)
+    if (lengths[symbol])
+      sorted[offsets[lengths[symbol]]++] = symbol;
+
+  uint16_t remaining[16];
+  memcpy(remaining, counts, sizeof(counts));
+
+  // The codes are read from the lowest bit of the input: tables are indexed
+  // by the codes reversed
+  uint32_t code = 0, end = 1u << bits, prefix = UINT32_MAX, start = 0;
+  uint16_t index = 0;
+
+  for (uint8_t length = 1; length < 16; length++, code <<= 1) {
+    for (uint16_t n = 0; n < counts[length]; n++, index++, code++) {
+      uint32_t reversed = 0;
+      for (uint8_t bit = 0; bit < length; bit++)
+        reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+
+      if (length <= bits) {
+        const uint32_t value = symbols[sorted[index]] | length;
+        for (uint32_t i = reversed; i < (1u << bits); i += 1u << length)
+          table[i] = value;
+      } else {
+        // A new subtable, large enough for the codes sharing its prefix
+        if ((reversed & ((1u << bits) - 1)) != prefix) {
+          prefix = reversed & ((1u << bits) - 1);
+          start = end;
+
+          uint8_t subBits = length - bits;
+          uint32_t used = remaining[length];
+          while (used < (1u << subBits) && bits + subBits < 15) {
+            subBits++;
+            used = (used << 1) + remaining[bits + subBits];
+          }
+
+          end = start + (1u << subBits);
+          if (end > size)
+            return false;
+
+          if (incomplete)
+            for (uint32_t i = start; i < end; i++)
+              table[i] = entry(0, INVALID, 0);
+
+          table[prefix] = entry(start, SUBTABLE, subBits) | bits;
+        }
+
+        const uint32_t value = symbols[sorted[index]] | (length - bits);
+        for (uint32_t i = start + (reversed >> bits); i < end;
+             i += 1u << (length - bits))
+          table[i] = value;
+      }
+
+      remaining[length]--;
+    }
+  }
+
+  return true;
+}
+
+struct FixedTables {
+  uint32_t litlen[LITLEN_SIZE], dist[DIST_SIZE];
+
+  FixedTables() {
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    buildTable(lengths, 288, alphabets.litlen, LITLEN_BITS, litlen,
+               LITLEN_SIZE);
+
+    memset(lengths, 5, 32);
+    buildTable(lengths, 32, alphabets.dist, DIST_BITS, dist, DIST_SIZE);
+  }
+};
+
+const FixedTables fixedTables;
+
+inline uint32_t readLE32(const uint8_t *data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | uint32_t(data[3]) << 24;
+}
+
+} // namespace
+
+bool inflateRaw(const uint8_t *data, const uint64_t length,
+                std::vector<uint8_t> *buffer, uint64_t *output,
+                uint64_t *input) {
+  const uint8_t *in = data, *const inEnd = data + length;
+
+  // The input is read in a 64 bits buffer, refilled before decoding every
+  // symbol. Past the end of the input, zeros are read and counted: using any
+  // of them is an error, and more than a buffer of them stops the decoding.
+  uint64_t bitBuffer = 0;
+  uint32_t bitsLeft = 0, overread = 0;
+
+  auto refill = [&]() {
+    if (inEnd - in >= 8) {
+      uint64_t word = 0;
+      for (uint8_t byte = 0; byte < 8; byte++)
+        word |= uint64_t(in[byte]) << (byte * 8);
+
+      bitBuffer |= word << bitsLeft;
+      in += (63 - bitsLeft) >> 3;
+      bitsLeft |= 56;
+    } else {
+      while (bitsLeft <= 56) {
+        if (in < inEnd)
+          bitBuffer |= uint64_t(*in++) << bitsLeft;
+        else
+          overread++;
+        bitsLeft += 8;
+      }
+    }
+  };
+
+  auto consume = [&](const uint8_t bits) {
+    bitBuffer >>= bits;
+    bitsLeft -= bits;
+  };
+
+  auto take = [&](const uint8_t bits) -> uint32_t {
+    const uint32_t value = bitBuffer & ((1ull << bits) - 1);
+    consume(bits);
+    return value;
+  };
+
+  // The output is written with pointers, the buffer being grown when less
+  // than a match and a copy overshoot are left
+  const uint32_t slack = 258 + 8;
+  if (buffer->size() < slack)
+    buffer->resize(slack);
+
+  uint8_t *base = buffer->data(), *out = base,
+          *outEnd = base + buffer->size();
+
+  auto reserve = [&](const uint64_t needed) {
+    if (uint64_t(outEnd - out) >= needed)
+      return;
+
+    const uint64_t done = out - base;
+    buffer->resize(std::max(buffer->size() * 2, done + needed));
+    base = buffer->data();
+    out = base + done;
+    outEnd = base + buffer->size();
+  };
+
+  uint32_t litlenDynamic[LITLEN_SIZE], distDynamic[DIST_SIZE];
+  bool final = false;
+
+  do {
+    refill();
+    final = take(1);
+    const uint8_t type = take(2);
+
+    const uint32_t *litlen = litlenDynamic, *dist = distDynamic;
+
+    if (type == 0) {
+      // Stored block: align on a byte, then go back to reading the input
+      // directly
+      consume(bitsLeft & 7);
+      const uint32_t buffered = bitsLeft >> 3;
+      if (buffered < overread)
+        return false;
+
+      in -= buffered - overread;
+      bitBuffer = bitsLeft = overread = 0;
+
+      if (inEnd - in < 4)
+        return false;
+
+      const uint16_t stored = in[0] | in[1] << 8,
+                     complement = in[2] | in[3] << 8;
+      in += 4;
+
+      if (stored != uint16_t(~complement) || uint64_t(inEnd - in) < stored)
+        return false;
+
+      reserve(stored + slack);
+      memcpy(out, in, stored);
+      out += stored;
+      in += stored;
+      continue;
+    } else if (type == 1) {
+      litlen = fixedTables.litlen;
+      dist = fixedTables.dist;
+    } else if (type == 2) {
+      // The lengths of the codes are themselves compressed with a code, whose
+      // lengths are given in this order
+      static const uint8_t order[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                        11, 4,  12, 3, 13, 2, 14, 1, 15};
+      uint8_t precodeLengths[19] = {0}, lengths[288 + 32] = {0};
+      uint32_t precode[PRECODE_SIZE];
+
+      const uint16_t litlenCount = take(5) + 257, distCount = take(5) + 1;
+      const uint8_t precodeCount = take(4) + 4;
+
+      for (uint8_t i = 0; i < precodeCount; i++) {
+        if (bitsLeft < 3)
+          refill();
+        precodeLengths[order[i]] = take(3);
+      }
+
+      if (!buildTable(precodeLengths, 19, alphabets.precode, PRECODE_BITS,
+                      precode, PRECODE_SIZE))
+        return false;
+
+      for (uint16_t i = 0; i < litlenCount + distCount;) {
+        refill();
+        if (overread > 8)
+          return false;
+
+        const uint32_t e = precode[bitBuffer & (PRECODE_SIZE - 1)];
+        if (entryType(e) != LITERAL)
+          return false;
+        consume(entryBits(e));
+
+        const uint8_t symbol = entryValue(e);
+        uint8_t value = 0, repeat = 1;
+
+        if (symbol < 16) {
+          value = symbol;
+        } else if (symbol == 16) {
+          if (!i)
+            return false;
+          value = lengths[i - 1];
+          repeat = 3 + take(2);
+        } else if (symbol == 17) {
+          repeat = 3 + take(3);
+        } else {
+          repeat = 11 + take(7);
+        }
+
+        if (i + repeat > litlenCount + distCount)
+          return false;
+
+        memset(lengths + i, value, repeat);
+        i += repeat;
+      }
+
+      // Without an end of block, the block cannot end
+      if (!lengths[256] ||
+          !buildTable(lengths, litlenCount, alphabets.litlen, LITLEN_BITS,
+                      litlenDynamic, LITLEN_SIZE) ||
+          !buildTable(lengths + litlenCount, distCount, alphabets.dist,
+                      DIST_BITS, distDynamic, DIST_SIZE))
+        return false;
+    } else {
+      return false;
+    }
+
+    // Decode the symbols of the block. A refill gives at least 56 bits, enough
+    // for a length and a distance with their extra bits.
+    while (true) {
+      refill();
+      if (overread > 8)
+        return false;
+
+      reserve(slack);
+
+      uint32_t e = litlen[bitBuffer & ((1u << LITLEN_BITS) - 1)];
+      if (entryType(e) == SUBTABLE) {
+        consume(LITLEN_BITS);
+        e = litlen[entryValue(e) + (bitBuffer & ((1u << entryExtra(e)) - 1))];
+      }
+      consume(entryBits(e));
+
+      const uint8_t type = entryType(e);
+
+      if (type == LITERAL) {
+        *out++ = entryValue(e);
+        continue;
+      }
+
+      if (type == END)
+        break;
+
+      if (type != LENGTH)
+        return false;
+
+      const uint32_t matchLength = entryValue(e) + take(entryExtra(e));
+
+      e = dist[bitBuffer & ((1u << DIST_BITS) - 1)];
+      if (entryType(e) == SUBTABLE) {
+        consume(DIST_BITS);
+        e = dist[entryValue(e) + (bitBuffer & ((1u << entryExtra(e)) - 1))];
+      }
+      consume(entryBits(e));
+
+      if (entryType(e) != LENGTH)
+        return false;
+
+      const uint32_t distance = entryValue(e) + take(entryExtra(e));
+      if (distance > uint64_t(out - base))
+        return false;
+
+      // Copy the match 8 bytes at a time when it does not overlap with
+      // itself; the slack at the end of the buffer absorbs the overshoot
+      const uint8_t *source = out - distance;
+      uint8_t *const matchEnd = out + matchLength;
+
+      if (distance >= 8) {
+        do {
+          memcpy(out, source, 8);
+          out += 8;
+          source += 8;
+        } while (out < matchEnd);
+      } else {
+        do
+          *out++ = *source++;
+        while (out < matchEnd);
+      }
+
+      out = matchEnd;
+    }
+  } while (!final);
+
+  // The bytes left in the bit buffer were not used
+  const uint32_t buffered = bitsLeft >> 3;
+  if (buffered < overread)
+    return false;
+
+  *output = out - base;
+  *input = (in - data) - (buffered - overread);
+  return true;
+}
+
+bool gunzip(const uint8_t *data, const uint64_t length,
+            std::vector<uint8_t> *buffer, uint64_t *output) {
+  // The header is 10 bytes long, followed by optional fields
+  uint64_t position = 10, input;
+  const uint8_t flags = length > 3 ? data[3] : 0;
+
+  if (length < 18 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8)
+    return false;
+
+  if (flags & 0x04) // Extra field
+    position += 2 + (data[position] | data[position + 1] << 8);
+  if (flags & 0x08) // File name
+    while (position < length && data[position++])
+      ;
+  if (flags & 0x10) // Comment
+    while (position < length && data[position++])
+      ;
+  if (flags & 0x02) // Header checksum
+    position += 2;
+
+  if (position + 8 <= length &&
+      inflateRaw(data + position, length - position - 8, buffer, output,
+                 &input)) {
+    // The trailer holds the checksum and the size of the data
+    const uint8_t *trailer = data + position + input;
+
+    if (readLE32(trailer) == crc32(0, buffer->data(), *output) &&
+        readLE32(trailer + 4) == uint32_t(*output))
+      return true;
+  }
+
+  logger::debug("Fast inflate failed, falling back to zlib\n");
+  return inflateStream(data, length, buffer, output);
+}
+
+bool unzlib(const uint8_t *data, const uint64_t length,
+            std::vector<uint8_t> *buffer, uint64_t *output) {
+  uint64_t input;
+
+  // Deflate method, without a preset dictionary
+  if (length >= 6 && (data[0] & 0x0f) == 8 && !(data[1] & 0x20) &&
+      !((data[0] << 8 | data[1]) % 31) &&
+      inflateRaw(data + 2, length - 6, buffer, output, &input)) {
+    const uint8_t *trailer = data + 2 + input;
+    const uint32_t checksum = uint32_t(trailer[0]) << 24 | trailer[1] << 16 |
+                              trailer[2] << 8 | trailer[3];
+
+    if (checksum == adler32(1, buffer->data(), *output))
+      return true;
+  }
+
+  logger::debug("Fast inflate failed, falling back to zlib\n");
+  return inflateStream(data, length, buffer, output);
+}
+
+bool copy(const uint8_t *data, const uint64_t length,
+          std::vector<uint8_t> *buffer, uint64_t *output) {
+  if (buffer->size() < length)
+    buffer->resize(length);
+
+  memcpy(buffer->data(), data, length);
+  *output = length;
+  return true;
+}
+
+bool unlz4(const uint8_t *data, const uint64_t length,
+           std::vector<uint8_t> *buffer, uint64_t *output) {
+  // Every block has a header: a magic string, the method and level, the
+  // compressed and decompressed sizes and a checksum. An empty block ends the
+  // stream.
+  const uint8_t headerSize = 21;
+  uint64_t position = 0, written = 0;
+
+  while (true) {
+    if (position + headerSize > length ||
+        memcmp(data + position, "LZ4Block", 8))
+      return false;
+
+    const uint8_t method = data[position + 8] & 0xf0,
+                  level = data[position + 8] & 0x0f;
+    const uint32_t compressed = readLE32(data + position + 9),
+                   decompressed = readLE32(data + position + 13);
+    position += headerSize;
+
+    if (!decompressed)
+      break;
+
+    // The blocks hold up to 2^(10 + level) bytes, 32 MiB at most, and an LZ4
+    // sequence expands less than 255 times: larger sizes are corrupted headers,
+    // rejected before the buffer is grown to them
+    if (position + compressed > length ||
+        decompressed > uint32_t(1) << (10 + level) ||
+        uint64_t(decompressed) > uint64_t(compressed) * 255)
+      return false;
+
+    if (buffer->size() < written + decompressed)
+      buffer->resize(std::max(buffer->size() * 2, written + decompressed));
+
+    const uint8_t *in = data + position, *const inEnd = in + compressed;
+    uint8_t *const start = buffer->data() + written, *out = start,
+                   *const outEnd = start + decompressed;
+
+    if (method == 0x10) {
+      // Raw block
+      if (compressed != decompressed)
+        return false;
+      memcpy(out, in, compressed);
+    } else if (method == 0x20) {
+      // LZ4 block: sequences of literals followed by a match, the last one
+      // having only literals
+      while (in < inEnd) {
+        const uint8_t token = *in++;
+        uint64_t literals = token >> 4;
+
+        if (literals == 15) {
+          uint8_t byte;
+          do {
+            if (in == inEnd)
+              return false;
+            byte = *in++;
+            literals += byte;
+          } while (byte == 255);
+        }
+
+        if (uint64_t(inEnd - in) < literals ||
+            uint64_t(outEnd - out) < literals)
+          return false;
+
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+
+        if (in == inEnd)
+          break;
+
+        if (inEnd - in < 2)
+          return false;
+
+        const uint16_t offset = in[0] | in[1] << 8;
+        in += 2;
+        uint64_t match = (token & 0x0f) + 4;
+
+        if ((token & 0x0f) == 15) {
+          uint8_t byte;
+          do {
+            if (in == inEnd)
+              return false;
+            byte = *in++;
+            match += byte;
+          } while (byte == 255);
+        }
+
+        if (!offset || offset > out - buffer->data() ||
+            uint64_t(outEnd - out) < match)
+          return false;
+
+        const uint8_t *source = out - offset;
+        while (match--)
+          *out++ = *source++;
+      }
+
+      if (out != outEnd)
+        return false;
+    } else {
+      return false;
+    }
+
+    position += compressed;
+    written += decompressed;
+  }
+
+  *output = written;
+  return true;
+}
+
+bool inflateStream(const uint8_t *data, const uint64_t length,
+                   std::vector<uint8_t> *buffer, uint64_t *output) {
+  if (buffer->empty())
+    buffer->resize(length);
+
+  z_stream zlibStream;
+  memset(&zlibStream, 0, sizeof(z_stream));
+  zlibStream.next_in = (Bytef *)data;
+  zlibStream.next_out = (Bytef *)buffer->data();
+  zlibStream.avail_in = length;
+  zlibStream.avail_out = buffer->size();
+  inflateInit2(&zlibStream, 32 + MAX_WBITS);
+
+  int status = inflate(&zlibStream, Z_FINISH);
+
+  // If the buffer is too small, grow it and resume where inflate stopped
+  while (status == Z_BUF_ERROR && !zlibStream.avail_out) {
+    const size_t done = buffer->size();
+    buffer->resize(done * 2);
+
+    zlibStream.next_out = (Bytef *)buffer->data() + done;
+    zlibStream.avail_out = buffer->size() - done;
+    status = inflate(&zlibStream, Z_FINISH);
+  }
+
+  inflateEnd(&zlibStream);
+
+  if (status != Z_STREAM_END) {
+    logger::debug("Decompressing chunk data failed: {}\n", zError(status));
+    return false;
+  }
+
+  *output = zlibStream.total_out;
+  return true;
+}
+
+Decompressor decompressor(const uint8_t method) {
+  switch (method) {
+  case GZIP:
+    return gunzip;
+  case ZLIB:
+    return unzlib;
+  case NONE:
+    return copy;
+  case LZ4:
+    return unlz4;
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace Compression
@@ -0,0 +1,51 @@
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include <stdint.h>
+#include <vector>
+
+// Chunk compression
+// The data of a chunk is preceded in its region by a byte giving how it was
+// compressed. Every method has its decompressor, writing the data at the
+// beginning of a buffer grown when needed, and returning its length.
+//
+// Deflate streams, wrapped in the zlib or gzip formats, are decoded in a
+// single pass over the whole input by the decoder below, and only go through
+// zlib's streaming inflate if it fails.
+namespace Compression {
+
+enum Method {
+  GZIP = 1,
+  ZLIB = 2,
+  NONE = 3,
+  LZ4 = 4,
+};
+
+typedef bool (*Decompressor)(const uint8_t *, const uint64_t,
+                             std::vector<uint8_t> *, uint64_t *);
+
+// Get the decompressor of a method, or nullptr if it is not supported
+Decompressor decompressor(const uint8_t method);
+
+bool gunzip(const uint8_t *, const uint64_t, std::vector<uint8_t> *,
+            uint64_t *);
+bool unzlib(const uint8_t *, const uint64_t, std::vector<uint8_t> *,
+            uint64_t *);
+bool copy(const uint8_t *, const uint64_t, std::vector<uint8_t> *,
+          uint64_t *);
+// The block streams of lz4-java, as written by recent servers
+bool unlz4(const uint8_t *, const uint64_t, std::vector<uint8_t> *,
+           uint64_t *);
+
+// Decode a raw deflate stream at once. The number of bytes of input used is
+// returned along the length of the output, to find the data after it.
+bool inflateRaw(const uint8_t *, const uint64_t, std::vector<uint8_t> *,
+                uint64_t *output, uint64_t *input);
+
+// Decode a zlib or gzip stream with zlib's streaming inflate
+bool inflateStream(const uint8_t *, const uint64_t, std::vector<uint8_t> *,
+                   uint64_t *);
+
+} // namespace Compression
+
+#endif // COMPRESSION_H_
@@ -12,7 +12,7 @@
 
 namespace PNG {
 
-Image::Image(const std::filesystem::path file, const IsometricCanvas *pixels)
+Image::Image(const std::filesystem::path file, const Canvas *pixels)
     : canvas(pixels) {
   imageHandle = nullptr;
   imageHandle = fopen(file.c_str(), "wb");
@@ -26,9 +26,13 @@ Image::Image(const std::filesystem::path file, const IsometricCanvas *pixels)
 }
 
 bool Image::create() {
+  uint32_t width, height;
 
-  const uint32_t width = canvas->getCroppedWidth(),
-                 height = canvas->getCroppedHeight();
+  {
+    Profiler::Timer timer(Profiler::CROP);
+    width = canvas->getCroppedWidth();
+    height = canvas->getCroppedHeight();
+  }
 
   if (!(width && height)) {
     logger::warn("Nothing to output: canvas is empty !\n");
@@ -36,7 +40,7 @@ bool Image::create() {
   }
 
   logger::debug("Image dimensions are {}x{}, 32bpp, {}MiB\n", width, height,
-                float(canvas->getCroppedSize() / float(1024 * 1024)));
+                float(canvas->getCroppedSize()) / float(1024 * 1024));
 
   fseeko(imageHandle, 0, SEEK_SET);
 
@@ -102,9 +106,19 @@ bool Image::save() {
     return false;
   }
 
-  uint8_t *srcLine = canvas->bytesBuffer + canvas->getCroppedOffset();
-  const uint64_t croppedHeight = canvas->getCroppedHeight();
+  uint8_t *srcLine;
+  uint64_t croppedHeight;
+
+  {
+    Profiler::Timer timer(Profiler::CROP);
+    srcLine = canvas->bytesBuffer + canvas->getCroppedOffset();
+    croppedHeight = canvas->getCroppedHeight();
+  }
+
+  Profiler::Timer timer(Profiler::ENCODE);
 
+  // The lines are read from the first cropped column, libpng only reading the
+  // cropped width from each
   logger::info("Writing to file...\n");
   for (uint64_t y = 0; y < croppedHeight; ++y) {
     png_write_row(pngPtr, (png_bytep)srcLine);
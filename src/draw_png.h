@@ -7,6 +7,7 @@
 #define BYTESPERPIXEL 4
 
 #include "./canvas.h"
+#include "./profiler.h"
 #include "./settings.h"
 #include "./worldloader.h"
 #include "colors.h"
@@ -33,11 +34,11 @@ struct Image {
 
   png_structp pngPtr;
   png_infop pngInfoPtr;
-  const IsometricCanvas *canvas;
+  const Canvas *canvas;
 
   bool ready = false;
 
-  Image(const std::filesystem::path file, const IsometricCanvas *pixels);
+  Image(const std::filesystem::path file, const Canvas *pixels);
 
   ~Image() {
     if (imageHandle)
@@ -0,0 +1,244 @@
+#include "./heatmap.h"
+#include "./canvas.h"
+#include "./logger.h"
+#include <algorithm>
+#include <cmath>
+#include <json.hpp>
+#include <map>
+#include <png.h>
+
+using nlohmann::json;
+
+namespace Heatmap {
+
+void Recorder::draw(const uint32_t x, const uint32_t y, const uint8_t blockX,
+                    const uint8_t blockZ, const uint8_t blockY) {
+  if (chunks.empty())
+    return;
+
+  ChunkStats &chunk = chunks.back();
+  const uint64_t owner =
+      ((uint64_t(chunks.size() - 1) << 16) |
+       (uint64_t(blockY) << 8 | (blockX & 0x0f) << 4 | (blockZ & 0x0f))) +
+      1;
+
+  chunk.drawn++;
+
+  // Blocks are drawn in a 4x4 square from their top left pixel
+  for (uint32_t row = y; row < std::min(y + 4, height); row++)
+    for (uint32_t column = x; column < std::min(x + 4, width); column++) {
+      const uint64_t pixel = column + uint64_t(row) * width;
+      if (writes[pixel] < UINT16_MAX)
+        writes[pixel]++;
+      owners[pixel] = owner;
+    }
+}
+
+void Recorder::merge(const Recorder &sub, const uint64_t anchor,
+                     const bool over) {
+  // The chunks of the sub-canvas are appended, their indexes shifted
+  const uint64_t shift = uint64_t(chunks.size()) << 16;
+  chunks.insert(chunks.end(), sub.chunks.begin(), sub.chunks.end());
+
+  // Same traversal as the canvas merge: the anchor is the pixel under the
+  // bottom left corner of the sub-canvas
+  for (uint32_t line = 1; line < sub.height + 1; line++) {
+    const uint64_t source = uint64_t(sub.height - line) * sub.width,
+                   destination = anchor - uint64_t(line) * width;
+
+    for (uint32_t pixel = 0; pixel < sub.width; pixel++) {
+      const uint64_t owner = sub.owners[source + pixel];
+      if (!owner)
+        continue;
+
+      uint16_t &count = writes[destination + pixel];
+      count = std::min(uint32_t(count) + sub.writes[source + pixel],
+                       uint32_t(UINT16_MAX));
+
+      // Over the canvas, the sub-canvas' blocks are in front; under it, they
+      // only show where the canvas is empty
+      if (over || !owners[destination + pixel])
+        owners[destination + pixel] = owner + shift;
+    }
+  }
+}
+
+void Recorder::countVisible() {
+  std::vector<uint64_t> visible(owners);
+  std::sort(visible.begin(), visible.end());
+  auto last = std::unique(visible.begin(), visible.end());
+
+  for (auto &chunk : chunks)
+    chunk.visible = 0;
+
+  for (auto it = visible.begin(); it != last; it++)
+    if (*it)
+      chunks[(*it - 1) >> 16].visible++;
+}
+
+// Color of a value between 0 and 1, from blue for low values to red
+void ramp(const double value, uint8_t *pixel) {
+  static const uint8_t stops[5][3] = {
+      {0, 0, 255}, {0, 255, 255}, {0, 255, 0}, {255, 255, 0}, {255, 0, 0}};
+
+  const double position = std::clamp(value, 0.0, 1.0) * 4;
+  const uint8_t stop = std::min(int(position), 3);
+  const double fraction = position - stop;
+
+  for (uint8_t channel = 0; channel < 3; channel++)
+    pixel[channel] =
+        stops[stop][channel] +
+        (stops[stop + 1][channel] - stops[stop][channel]) * fraction;
+  pixel[3] = 255;
+}
+
+bool writePNG(const std::filesystem::path &file, const uint8_t *pixels,
+              const uint32_t width, const uint32_t height) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  image.format = PNG_FORMAT_RGBA;
+  image.width = width;
+  image.height = height;
+
+  if (!png_image_write_to_file(&image, file.c_str(), 0, pixels, 0, nullptr)) {
+    logger::error("Writing heatmap {} failed: {}\n", file.c_str(),
+                  image.message);
+    return false;
+  }
+
+  return true;
+}
+
+std::filesystem::path sibling(const std::filesystem::path &output,
+                              const std::string &suffix) {
+  return output.parent_path() / (output.stem().string() + suffix);
+}
+
+bool save(Recorder &recorder, const IsometricCanvas &canvas,
+          const std::filesystem::path &output) {
+  recorder.countVisible();
+
+  // Overdraw, cropped like the image. The number of draws is shown on a
+  // logarithmic scale, as most pixels are drawn a few times.
+  const uint32_t croppedWidth = canvas.getCroppedWidth(),
+                 croppedHeight = canvas.getCroppedHeight();
+  const uint64_t first = canvas.getCroppedOffset() / BYTESPERPIXEL;
+  const uint16_t maxWrites =
+      *std::max_element(recorder.writes.begin(), recorder.writes.end());
+  uint64_t covered = 0, draws = 0;
+
+  std::vector<uint8_t> pixels(uint64_t(croppedWidth) * croppedHeight * 4, 0);
+  for (uint64_t pixel = 0; pixel < uint64_t(croppedWidth) * croppedHeight;
+       pixel++) {
+    const uint16_t count =
+        recorder.writes[first + (pixel / croppedWidth) * canvas.width +
+                        pixel % croppedWidth];
+    if (!count)
+      continue;
+
+    covered++;
+    draws += count;
+    ramp(maxWrites > 1 ? log(count) / log(maxWrites) : 0, &pixels[pixel * 4]);
+  }
+
+  if (croppedHeight &&
+      !writePNG(sibling(output, ".overdraw.png"), pixels.data(), croppedWidth,
+                croppedHeight))
+    return false;
+
+  // A chunk crossing the border of two splits is rendered by both, so its
+  // statistics are summed
+  std::map<std::pair<int32_t, int32_t>, ChunkStats> merged;
+  for (auto &chunk : recorder.chunks) {
+    auto inserted = merged.emplace(std::make_pair(chunk.z, chunk.x), chunk);
+    if (!inserted.second) {
+      inserted.first->second.decoded += chunk.decoded;
+      inserted.first->second.drawn += chunk.drawn;
+      inserted.first->second.visible += chunk.visible;
+    }
+  }
+
+  // Chunks, seen from above with the north up, colored by the number of
+  // blocks decoded that are not visible
+  int32_t minX = INT32_MAX, maxX = INT32_MIN, minZ = INT32_MAX,
+          maxZ = INT32_MIN;
+  uint64_t maxWasted = 1, decoded = 0, drawn = 0, visible = 0;
+  json chunks = json::array();
+
+  for (auto &element : merged) {
+    const ChunkStats &chunk = element.second;
+    minX = std::min(minX, chunk.x);
+    maxX = std::max(maxX, chunk.x);
+    minZ = std::min(minZ, chunk.z);
+    maxZ = std::max(maxZ, chunk.z);
+    maxWasted = std::max(maxWasted, chunk.decoded - chunk.visible);
+    decoded += chunk.decoded;
+    drawn += chunk.drawn;
+    visible += chunk.visible;
+    chunks.push_back({{"x", chunk.x},
+                      {"z", chunk.z},
+                      {"decoded", chunk.decoded},
+                      {"drawn", chunk.drawn},
+                      {"visible", chunk.visible}});
+  }
+
+  if (!merged.empty()) {
+    // Small maps are scaled up to stay readable
+    const uint32_t chunksX = maxX - minX + 1, chunksZ = maxZ - minZ + 1;
+    const uint32_t scale =
+        std::clamp(256 / std::max(chunksX, chunksZ), uint32_t(1), uint32_t(16));
+    const uint32_t mapWidth = chunksX * scale, mapHeight = chunksZ * scale;
+    pixels.assign(uint64_t(mapWidth) * mapHeight * 4, 0);
+
+    for (auto &element : merged) {
+      const ChunkStats &chunk = element.second;
+      uint8_t color[4];
+      ramp(double(chunk.decoded - chunk.visible) / maxWasted, color);
+
+      for (uint32_t row = 0; row < scale; row++)
+        for (uint32_t column = 0; column < scale; column++)
+          memcpy(&pixels[((chunk.x - minX) * scale + column +
+                          uint64_t((chunk.z - minZ) * scale + row) *
+                              mapWidth) *
+                         4],
+                 color, 4);
+    }
+
+    if (!writePNG(sibling(output, ".chunks.png"), pixels.data(), mapWidth,
+                  mapHeight))
+      return false;
+  }
+
+  json summary = {
+      {"pixels",
+       {{"covered", covered}, {"draws", draws}, {"max_draws", maxWrites}}},
+      {"blocks",
+       {{"decoded", decoded}, {"drawn", drawn}, {"visible", visible}}},
+      {"chunks", chunks},
+  };
+
+  const std::filesystem::path summaryFile = sibling(output, ".heatmap.json");
+  FILE *f = fopen(summaryFile.c_str(), "w");
+
+  if (!f) {
+    logger::error("Opening {} failed: {}\n", summaryFile.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  fmt::print(f, "{}\n", summary.dump(2));
+  fclose(f);
+
+  logger::info("Overdraw: {} draws over {} pixels, {:.2f} per pixel, {} at "
+               "most\n",
+               draws, covered, covered ? double(draws) / covered : 0.0,
+               maxWrites);
+  logger::info("Blocks: {} decoded, {} drawn, {} visible ({:.2f}%)\n",
+               decoded, drawn, visible,
+               decoded ? 100.0 * visible / decoded : 0.0);
+
+  return true;
+}
+
+} // namespace Heatmap
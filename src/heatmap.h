@@ -0,0 +1,63 @@
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include <filesystem>
+#include <stdint.h>
+#include <vector>
+
+struct IsometricCanvas;
+
+// Heatmap
+// Debug statistics on the rendering, recorded alongside a canvas: how many
+// times every pixel was drawn, which block drew it last, and for every chunk
+// how many blocks were decoded, drawn, and visible in the final image. The
+// blocks are identified by the index of their chunk in the recorder and their
+// position in the chunk, so the data of sub-canvases can be merged.
+namespace Heatmap {
+
+struct ChunkStats {
+  int32_t x, z;
+  uint64_t decoded, drawn, visible;
+};
+
+struct Recorder {
+  uint32_t width, height;
+
+  std::vector<uint16_t> writes; // Number of blocks drawn over every pixel
+  // The last block drawn over every pixel: the chunk index shifted by 16 bits
+  // and the position of the block in its chunk, plus one. 0 is no block.
+  std::vector<uint64_t> owners;
+  std::vector<ChunkStats> chunks;
+
+  Recorder(const uint32_t width, const uint32_t height)
+      : width(width), height(height), writes(uint64_t(width) * height, 0),
+        owners(uint64_t(width) * height, 0) {}
+
+  void beginChunk(const int32_t x, const int32_t z) {
+    chunks.push_back({x, z, 0, 0, 0});
+  }
+
+  void decoded(const uint64_t blocks) {
+    if (!chunks.empty())
+      chunks.back().decoded += blocks;
+  }
+
+  // Record a block drawn with its top left pixel at x, y. The block's
+  // coordinates identify it in its chunk.
+  void draw(const uint32_t x, const uint32_t y, const uint8_t blockX,
+            const uint8_t blockZ, const uint8_t blockY);
+
+  // Import the data of a sub-canvas, the same way its pixels are merged
+  void merge(const Recorder &, const uint64_t anchor, const bool over);
+
+  // Count the blocks still owning a pixel, once the canvas is complete
+  void countVisible();
+};
+
+// Write the heatmaps of the canvas next to the image: the number of draws per
+// pixel, the cost of every chunk, and the statistics as json
+bool save(Recorder &, const IsometricCanvas &, const std::filesystem::path &);
+
+} // namespace Heatmap
+
+#endif // HEATMAP_H_
@@ -33,8 +33,12 @@ bool isNumeric(const char *str) {
 }
 
 void splitCoords(const Coordinates &original, Coordinates *&subCoords,
-                 const uint16_t count) {
-  // Split the coordinates of the entire terrain in `count` terrain fragments
+                 const uint16_t count, const uint8_t scale) {
+  // Split the coordinates of the entire terrain in `count` terrain fragments.
+  // When drawing at a reduced scale, the fragments are made of whole cells of
+  // 2^scale blocks, so a cell is never drawn by two fragments.
+  const int32_t firstCell = original.minX >> scale;
+  const int32_t cells = (original.maxX >> scale) - firstCell + 1;
 
   for (uint16_t index = 0; index < count; index++) {
     // Initialization with the original's values
@@ -47,7 +51,7 @@ void splitCoords(const Coordinates &original, Coordinates *&subCoords,
 
     // Each fragment has a fixed size
     subCoords[index].maxX =
-        subCoords[index].minX + (original.maxX - original.minX + 1) / count - 1;
+        (firstCell + (index + 1) * (cells / count)) * (1 << scale) - 1;
 
     // Adjust the last terrain fragment to make sure the terrain is fully
     // covered
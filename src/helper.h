@@ -41,7 +41,6 @@
 
 #define REGION_HEADER_SIZE REGIONSIZE *REGIONSIZE * 4
 #define DECOMPRESSED_BUFFER 1000 * 1024
-#define COMPRESSED_BUFFER 100 * 1024
 
 #define CHUNK(x) ((x) >> 4)
 #define REGION(x) ((x) >> 5)
@@ -100,6 +99,6 @@ struct Coordinates {
 };
 
 void splitCoords(const Coordinates &original, Coordinates *&subCoords,
-                 const uint16_t count);
+                 const uint16_t count, const uint8_t scale = 0);
 
 #endif // HELPER_H_
@@ -11,7 +11,8 @@ bool prettyErr = isatty(STDERR_FILENO);
 namespace logger {
 
 void vinfo(const char *format, fmt::format_args args) {
-  fmt::vprint(format, args);
+  if (level != QUIET)
+    fmt::vprint(format, args);
 }
 
 void vwarning(const char *format, fmt::format_args args) {
@@ -45,13 +46,15 @@ void vdebug(const char *format, fmt::format_args args) {
 
 void setDebug() { level = DEBUG; }
 
+void setQuiet() { level = QUIET; }
+
 static auto last = std::chrono::high_resolution_clock::now();
 
 void printProgress(const std::string label, const uint64_t current,
                    const uint64_t max) {
 #define PROGRESS(X) fmt::print(stderr, label + " [{:.{}f}%]\r", X, 2)
   // Keep user updated but don't spam the console
-  if (!(prettyErr && prettyOut))
+  if (!(prettyErr && prettyOut) || level == QUIET)
     return;
 
   if (current == 0) { // Reset
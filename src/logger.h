@@ -13,6 +13,7 @@ enum levels {
   WARNING,
   ERROR,
   DEBUG,
+  QUIET,
 };
 
 void vinfo(const char *format, fmt::format_args args);
@@ -41,6 +42,8 @@ void debug(const char *format, const Args &... args) {
 }
 
 void setDebug();
+// Silence the informational messages and the progress bars
+void setQuiet();
 
 void printProgress(const std::string label, const uint64_t current,
                    const uint64_t max);
@@ -1,17 +1,15 @@
 #include "./VERSION"
-#include "./draw_png.h"
+#include "./batch.h"
 #include "./helper.h"
 #include "./logger.h"
+#include "./render.h"
+#include "./server.h"
 #include "./settings.h"
-#include "./worldloader.h"
-#include <algorithm>
 #include <string>
-#include <utility>
 
 using std::string;
 
 void printHelp(char *binary);
-void render(IsometricCanvas *canvas, const Terrain::Data &world);
 
 void printHelp(char *binary) {
   logger::info(
@@ -21,7 +19,12 @@ void printHelp(char *binary) {
       "  -min/max VAL        minimum/maximum Y index of blocks to render\n"
       "  -file NAME          output file; default is 'output.png'\n"
       "  -colors NAME        color file to use; default is 'colors.json'\n"
+      "  -select NAME        only render the chunks selected in NAME\n"
       "  -nw -ne -se -sw     the orientation of the map\n"
+      "  -allorientations    render the map in the four orientations at once, "
+      "to\n"
+      "                      NAME.nw.png, NAME.ne.png, NAME.se.png and "
+      "NAME.sw.png\n"
       "  -nether             render the nether\n"
       "  -end                render the end\n"
       "  -dim[ension] NAME   render a dimension by namespaced ID\n"
@@ -29,11 +32,30 @@ void printHelp(char *binary) {
       "  -nobeacons          do not render beacon beams\n"
       "  -shading            toggle shading (brightens blocks depending on "
       "height)\n"
+      "  -topdown            render the map seen from above, one pixel per "
+      "block\n"
+      "  -scale 1/N          draw a block for every NxN blocks, N being 2, 4 "
+      "or 8\n"
+      "  -surface-depth N    only draw the N highest blocks of every column\n"
 #ifndef DISABLE_OMP
       "  -splits VAL         render with VAL threads\n"
 #endif
       "  -marker X Z color   draw a marker at X Z of the desired color\n"
+      "  -markers NAME       draw the markers listed in NAME, in json or csv\n"
       "  -padding VAL        padding to use around the image (default 5)\n"
+      "  -cache VAL          keep up to VAL MiB of regions and decompressed\n"
+      "                      chunks in memory, to share them between splits\n"
+      "  -profile NAME       save render timings and throughput to NAME\n"
+      "  -batch NAME         render all the jobs listed in NAME, sharing the\n"
+      "                      caches and palettes between them\n"
+      "  -serve ADDRESS      serve tiles of the map on demand over HTTP, on "
+      "the\n"
+      "                      local port or Unix socket ADDRESS\n"
+      "  -tilecache VAL      keep up to VAL MiB of tiles in memory when "
+      "serving\n"
+      "  -workers VAL        render up to VAL tiles at once when serving\n"
+      "  -heatmap            save heatmaps of the pixels drawn over and the\n"
+      "                      cost of every chunk next to the image\n"
       "  -h[elp]             display an option summary\n"
       "  -v[erbose]          toggle debug mode\n"
       "  -dumpcolors         dump a json with all defined colors\n",
@@ -63,69 +85,23 @@ int main(int argc, char **argv) {
                  8 * static_cast<int>(sizeof(size_t)));
   }
 
-  // Get the relevant options from the options parsed
-  Terrain::Coordinates coords = options.boundaries;
-  const std::filesystem::path regionDir = options.regionDir();
-
-  // Overwrite water if asked to
-  // TODO expand this to other blocks
-  if (options.hideWater)
-    colors["minecraft:water"] = Colors::Block();
-  if (options.hideBeacons)
-    colors["mcmap:beacon_beam"] = Colors::Block();
-
-  // This is the canvas on which the final image will be rendered
-  IsometricCanvas finalCanvas(coords, colors, options.padding);
-
-  // Prepare the sub-regions to render
-  // This could be bypassed when the program is run in single-threaded mode, but
-  // it works just fine when run in single threaded, so why bother making huge
-  // if-elses ?
-  Terrain::Coordinates *subCoords = new Terrain::Coordinates[options.splits];
-  splitCoords(coords, subCoords, options.splits);
-
-#ifndef DISABLE_OMP
-#pragma omp parallel shared(finalCanvas)
-#endif
-  {
-#ifndef DISABLE_OMP
-#pragma omp for ordered schedule(static)
-#endif
-    for (uint16_t i = 0; i < options.splits; i++) {
-      // Load the minecraft terrain to render
-      Terrain::Data world(subCoords[i]);
-      world.load(regionDir);
-
-      // Cap the height to avoid having a ridiculous image height
-      subCoords[i].minY = std::max(subCoords[i].minY, world.minHeight());
-      subCoords[i].maxY = std::min(subCoords[i].maxY, world.maxHeight());
-
-      // Pre-cache the colors used in the part of the world loaded to squeeze a
-      // few milliseconds of color lookup
-      Colors::Palette localColors;
-      Colors::filter(colors, world.cache, &localColors);
-
-      // Draw the terrain fragment
-      IsometricCanvas canvas(subCoords[i], localColors);
-      canvas.shading = options.shading;
-      canvas.setMarkers(options.totalMarkers, &options.markers);
-      canvas.renderTerrain(world);
-
-#ifndef DISABLE_OMP
-#pragma omp ordered
-#endif
-      {
-        // Merge the terrain fragment into the final canvas. The ordered
-        // directive in the pragma is primordial, as the merging algorithm
-        // cannot merge terrain when not in order.
-        finalCanvas.merge(canvas);
-      }
-    }
+  // The regions and their chunks are shared between the splits through the
+  // region cache, and between the jobs of a batch or the tiles served
+  Terrain::RegionCache::global().setBudget(
+      options.cacheBudget, options.keepChunks ||
+                               options.mode == Settings::BATCH ||
+                               options.mode == Settings::SERVE);
+
+  if (options.mode == Settings::BATCH) {
+    if (!Batch::run(options.batchFile, colors))
+      return 1;
+  } else if (options.mode == Settings::SERVE) {
+    if (!Server::serve(options, colors))
+      return 1;
+  } else {
+    Render::render(options, colors);
   }
 
-  delete[] subCoords;
-
-  PNG::Image(options.outFile, &finalCanvas).save();
   logger::info("Job complete.\n");
 
   return 0;
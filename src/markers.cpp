@@ -0,0 +1,120 @@
+#include "./markers.h"
+#include "./logger.h"
+#include <cctype>
+#include <fstream>
+#include <json.hpp>
+
+using nlohmann::json;
+
+void Markers::Store::add(const Colors::Marker &marker) {
+  chunks[Terrain::chunkKey(CHUNK(marker.x), CHUNK(marker.z))].push_back(
+      markers.size());
+  markers.push_back(marker);
+}
+
+const std::vector<uint32_t> *Markers::Store::inChunk(const int32_t x,
+                                                     const int32_t z) const {
+  auto chunk = chunks.find(Terrain::chunkKey(x, z));
+  return chunk == chunks.end() ? nullptr : &chunk->second;
+}
+
+bool Markers::load(const std::filesystem::path &file, Store *store) {
+  const size_t before = store->size();
+
+  if (file.extension() == ".csv" ? !loadCSV(file, store)
+                                 : !loadJSON(file, store))
+    return false;
+
+  logger::debug("Loaded {} markers from {}\n", store->size() - before,
+                file.c_str());
+
+  return true;
+}
+
+bool Markers::loadJSON(const std::filesystem::path &file, Store *store) {
+  json data;
+
+  FILE *f = fopen(file.c_str(), "r");
+  if (!f) {
+    logger::error("Could not open marker file {}: {}\n", file.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  try {
+    data = json::parse(f);
+  } catch (const nlohmann::detail::parse_error &err) {
+    logger::error("Parsing marker file {} failed: {}\n", file.c_str(),
+                  err.what());
+    fclose(f);
+    return false;
+  }
+
+  fclose(f);
+
+  if (!data.is_array()) {
+    logger::error("Invalid marker file {}: not a list of markers\n",
+                  file.c_str());
+    return false;
+  }
+
+  try {
+    for (auto &marker : data)
+      store->add(Colors::Marker(marker["x"].get<int64_t>(),
+                                marker["z"].get<int64_t>(),
+                                marker.value("color", std::string("white"))));
+  } catch (const nlohmann::detail::exception &err) {
+    logger::error("Invalid marker file {}: {}\n", file.c_str(), err.what());
+    return false;
+  }
+
+  return true;
+}
+
+bool Markers::loadCSV(const std::filesystem::path &file, Store *store) {
+  std::ifstream input(file);
+  if (!input) {
+    logger::error("Could not open marker file {}: {}\n", file.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  std::string line;
+  uint64_t number = 0;
+
+  while (std::getline(input, line)) {
+    number++;
+
+    // Headers and comments do not start with a coordinate
+    const size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos ||
+        !(isdigit((unsigned char)line[start]) || line[start] == '-'))
+      continue;
+
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+
+    while (std::getline(stream, field, ',')) {
+      const size_t first = field.find_first_not_of(" \t\r"),
+                   last = field.find_last_not_of(" \t\r");
+      fields.push_back(first == std::string::npos
+                           ? ""
+                           : field.substr(first, last - first + 1));
+    }
+
+    // Coordinates fit in 32 bits, hence the length check
+    if (fields.size() < 2 || fields[0].size() > 11 || fields[1].size() > 11 ||
+        !isNumeric(fields[0].c_str()) || !isNumeric(fields[1].c_str())) {
+      logger::error("Invalid marker on line {} of {}\n", number, file.c_str());
+      return false;
+    }
+
+    store->add(Colors::Marker(std::stoll(fields[0]), std::stoll(fields[1]),
+                              fields.size() > 2 && !fields[2].empty()
+                                  ? fields[2]
+                                  : "white"));
+  }
+
+  return true;
+}
@@ -0,0 +1,47 @@
+#ifndef MARKERS_H_
+#define MARKERS_H_
+
+#include "./colors.h"
+#include "./worldloader.h"
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+// Markers
+// Beams drawn over points of interest of the map, like claims or portals.
+// They are given on the command line with `-marker`, or by the thousands in
+// files with `-markers`. A file ending in `.csv` holds a marker per line:
+//
+//   x,z,color
+//
+// the color being optional, and lines not starting with a number being
+// skipped. Any other file is a json list of markers:
+//
+//   [{"x": X, "z": Z, "color": "red"}, ...]
+//
+// The markers are indexed by chunk, so the chunks drawn only look at their
+// own markers.
+namespace Markers {
+
+struct Store {
+  std::vector<Colors::Marker> markers;
+
+  // The indexes of the markers inside every chunk, by packed coordinates
+  std::unordered_map<uint64_t, std::vector<uint32_t>> chunks;
+
+  void add(const Colors::Marker &);
+
+  // The markers inside a chunk, or nullptr if there is none
+  const std::vector<uint32_t> *inChunk(const int32_t, const int32_t) const;
+
+  size_t size() const { return markers.size(); }
+};
+
+bool load(const std::filesystem::path &, Store *);
+
+bool loadJSON(const std::filesystem::path &, Store *);
+bool loadCSV(const std::filesystem::path &, Store *);
+
+} // namespace Markers
+
+#endif // MARKERS_H_
@@ -0,0 +1,241 @@
+/**
+ * This file contains the entrypoints of the library, translating its
+ * parameters into the options of the renderer
+ */
+
+#include "./mcmap.h"
+#include "./draw_png.h"
+#include "./logger.h"
+#include "./regioncache.h"
+#include "./render.h"
+#include "./settings.h"
+#include <map>
+#include <mutex>
+#ifndef DISABLE_OMP
+#include <omp.h>
+#endif
+
+namespace mcmap {
+
+struct World::State {
+  std::filesystem::path save;
+  Settings::Dimension dimension;
+
+  // The terrain found when opening the world
+  Coordinates extent;
+  Terrain::ChunkSet existing;
+
+  // The palettes loaded, by color file, shared between renders
+  std::mutex palettesMutex;
+  std::map<std::filesystem::path, Colors::Palette> palettes;
+
+  State(const std::filesystem::path &save, const Settings::Dimension &dim)
+      : save(save), dimension(dim) {}
+
+  const Colors::Palette &palette(const std::filesystem::path &colorFile) {
+    std::lock_guard<std::mutex> lock(palettesMutex);
+
+    auto loaded = palettes.find(colorFile);
+    if (loaded != palettes.end())
+      return loaded->second;
+
+    Colors::Palette &colors = palettes[colorFile];
+    Colors::load(colorFile, &colors);
+    return colors;
+  }
+};
+
+World::World() {}
+
+World::~World() {}
+
+bool World::open(const std::filesystem::path &save,
+                 const std::string &dimension) {
+  Settings::Dimension dim(dimension);
+  const std::filesystem::path regionDir = dim.regionDir(save);
+
+  if (regionDir.empty() || !std::filesystem::exists(regionDir)) {
+    logger::error("Cannot open dimension '{}' of world '{}': file '{}' does "
+                  "not exist\n",
+                  dim.to_string(), save.c_str(), regionDir.c_str());
+    state.reset();
+    return false;
+  }
+
+  state.reset(new State(save, dim));
+  scanWorldDirectory(regionDir, &state->extent, &state->existing);
+
+  return true;
+}
+
+bool World::bounds(int32_t *minX, int32_t *minZ, int32_t *maxX,
+                   int32_t *maxZ) const {
+  if (!state || state->extent.isUndefined())
+    return false;
+
+  *minX = state->extent.minX;
+  *minZ = state->extent.minZ;
+  *maxX = state->extent.maxX;
+  *maxZ = state->extent.maxZ;
+
+  return true;
+}
+
+// Translate the parameters of a render into the options of the renderer, like
+// the command line would
+bool options(const World::State &world, const Parameters &parameters,
+             Settings::WorldOptions *opts) {
+  opts->saveName = world.save;
+  opts->dim = world.dimension;
+  opts->existing = world.existing;
+
+  opts->boundaries = world.extent;
+  if (parameters.bounded) {
+    Coordinates bounds;
+    bounds.minX = parameters.minX;
+    bounds.minZ = parameters.minZ;
+    bounds.maxX = parameters.maxX;
+    bounds.maxZ = parameters.maxZ;
+
+    opts->boundaries.crop(bounds);
+  }
+
+  opts->boundaries.minY = parameters.minY;
+  opts->boundaries.maxY = parameters.maxY;
+  opts->boundaries.orientation = ::Orientation(parameters.orientation);
+
+  if (opts->boundaries.maxX < opts->boundaries.minX ||
+      opts->boundaries.maxZ < opts->boundaries.minZ) {
+    logger::error("Nothing to render: no terrain in the area\n");
+    return false;
+  }
+
+  if (opts->boundaries.maxY < opts->boundaries.minY) {
+    logger::error("Nothing to render: minY has to be <= maxY\n");
+    return false;
+  }
+
+  if (parameters.scale > 3) {
+    logger::error("Invalid scale {}: at most 3, for 1/8\n", parameters.scale);
+    return false;
+  }
+
+  opts->topdown = parameters.view == TOPDOWN;
+  opts->scale = parameters.scale;
+  opts->surfaceDepth = parameters.surfaceDepth;
+  opts->padding = parameters.padding;
+  opts->shading = parameters.shading;
+  opts->hideWater = parameters.hideWater;
+  opts->hideBeacons = parameters.hideBeacons;
+
+  // Small maps cannot be split much: instead of failing like the command
+  // line, use as many splits as possible
+  const int64_t length = (opts->boundaries.maxX >> opts->scale) -
+                         (opts->boundaries.minX >> opts->scale) + 1;
+  opts->splits = parameters.splits;
+
+  if (!opts->splits) {
+#ifndef DISABLE_OMP
+    opts->splits = omp_get_max_threads();
+#else
+    opts->splits = 1;
+#endif
+  }
+
+  opts->splits = std::min(int64_t(opts->splits), length);
+
+  return true;
+}
+
+bool render(const World &world, const Parameters &parameters,
+            const Callbacks &callbacks, Image *image) {
+  if (!world.state) {
+    logger::error("Cannot render a world that is not open\n");
+    return false;
+  }
+
+  Settings::WorldOptions opts;
+  if (!options(*world.state, parameters, &opts))
+    return false;
+
+  Render::Hooks hooks;
+  hooks.progress = callbacks.progress;
+  hooks.cancelled = callbacks.cancelled;
+
+  // The buffer of the caller may hold a previous image, and is cleared
+  Canvas::Allocator buffer = nullptr;
+  if (callbacks.buffer)
+    buffer = [&callbacks](const uint32_t width, const uint32_t height) {
+      uint8_t *pixels = callbacks.buffer(width, height);
+      if (pixels)
+        memset(pixels, 0, uint64_t(width) * height * BYTESPERPIXEL);
+      return pixels;
+    };
+
+  std::unique_ptr<Canvas> canvas = Render::draw(
+      opts, world.state->palette(parameters.colorFile), hooks, buffer);
+
+  if (!canvas)
+    return false;
+
+  image->width = canvas->width;
+  image->height = canvas->height;
+  image->padding = canvas->padding;
+  image->cropWidth = canvas->getCroppedWidth();
+  image->cropHeight = canvas->getCroppedHeight();
+  image->cropX = image->cropWidth ? canvas->firstColumn() : 0;
+  image->cropY = image->cropHeight ? canvas->firstLine() : 0;
+
+  if (!callbacks.tile || !callbacks.tileSize)
+    return true;
+
+  const uint64_t stride = uint64_t(canvas->width) * BYTESPERPIXEL;
+
+  for (uint32_t y = 0; y < image->cropHeight; y += callbacks.tileSize)
+    for (uint32_t x = 0; x < image->cropWidth; x += callbacks.tileSize) {
+      Tile tile;
+      tile.x = x;
+      tile.y = y;
+      tile.width = std::min(callbacks.tileSize, image->cropWidth - x);
+      tile.height = std::min(callbacks.tileSize, image->cropHeight - y);
+      tile.pixels = canvas->pixel(image->cropX + x, image->cropY + y);
+      tile.stride = stride;
+
+      callbacks.tile(tile);
+    }
+
+  return true;
+}
+
+bool savePNG(const std::filesystem::path &file, const uint8_t *pixels,
+             const Image &image) {
+  // The pixels are wrapped in a canvas without taking ownership, for the
+  // image to crop them the same way
+  Canvas canvas(Coordinates(), image.padding);
+  canvas.width = image.width;
+  canvas.height = image.height;
+  canvas.size = uint64_t(image.width) * image.height * BYTESPERPIXEL;
+  canvas.bytesBuffer = const_cast<uint8_t *>(pixels);
+
+  if (image.cropWidth && image.cropHeight)
+    canvas.markDrawn(image.cropX + image.padding, image.cropY + image.padding,
+                     image.cropX + image.cropWidth - 1 - image.padding,
+                     image.cropY + image.cropHeight - 1 - image.padding);
+
+  try {
+    return PNG::Image(file, &canvas).save();
+  } catch (const std::runtime_error &err) {
+    logger::error("{}\n", err.what());
+    return false;
+  }
+}
+
+void setCacheBudget(uint64_t bytes) {
+  // Renders are independent calls: keep the decompressed chunks for the next
+  // ones
+  Terrain::RegionCache::global().setBudget(bytes, true);
+}
+
+void setQuiet() { logger::setQuiet(); }
+
+} // namespace mcmap
@@ -0,0 +1,133 @@
+#ifndef MCMAP_H_
+#define MCMAP_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+
+// libmcmap
+// The renderer as a library, for programs drawing maps without running the
+// executable. A world is opened once and kept between renders, its regions and
+// chunks staying in the region cache. Every render draws into a buffer of RGBA
+// pixels, provided by the caller or read through a tile callback, and encoding
+// it as a PNG file is optional.
+//
+// This header is the only one to include: it does not depend on the internals
+// of the renderer, that may change from one version to the next.
+//
+//   mcmap::World world;
+//   world.open("saves/World");
+//
+//   mcmap::Parameters parameters;
+//   parameters.orientation = mcmap::NE;
+//
+//   std::vector<uint8_t> pixels;
+//   mcmap::Callbacks callbacks;
+//   callbacks.buffer = [&](uint32_t width, uint32_t height) {
+//     pixels.resize(uint64_t(width) * height * 4);
+//     return pixels.data();
+//   };
+//
+//   mcmap::Image image;
+//   if (mcmap::render(world, parameters, callbacks, &image))
+//     mcmap::savePNG("map.png", pixels.data(), image);
+namespace mcmap {
+
+enum Orientation { NW, SW, NE, SE };
+
+enum View {
+  ISOMETRIC, // The default view, blocks drawn in 3D
+  TOPDOWN,   // The terrain seen from above, one pixel per column
+};
+
+// A dimension of a save, opened to render it
+struct World {
+  World();
+  ~World();
+
+  // Open the dimension of a save, by namespaced ID. Returns false if it does
+  // not exist.
+  bool open(const std::filesystem::path &save,
+            const std::string &dimension = "overworld");
+
+  // The terrain found in the dimension, in blocks
+  bool bounds(int32_t *minX, int32_t *minZ, int32_t *maxX,
+              int32_t *maxZ) const;
+
+  struct State;
+  std::unique_ptr<State> state;
+};
+
+// What to draw, and how
+struct Parameters {
+  // The area to draw, in blocks; the whole world unless bounded
+  bool bounded = false;
+  int32_t minX = 0, minZ = 0, maxX = 0, maxZ = 0;
+  uint8_t minY = 0, maxY = 255;
+
+  Orientation orientation = NW;
+  View view = ISOMETRIC;
+  uint8_t scale = 0; // Draw a block for every 2^scale blocks on each side
+  uint8_t surfaceDepth = 0; // Only draw the blocks this deep, if not 0
+
+  uint16_t padding = 5;
+  bool shading = false, hideWater = false, hideBeacons = false;
+
+  uint16_t splits = 0; // Parts drawn in parallel, one per thread if 0
+  std::filesystem::path colorFile; // The colors to use, built-in if empty
+};
+
+// The image drawn, and the area of it covered by terrain
+struct Image {
+  uint32_t width = 0, height = 0; // The size of the buffer, in pixels
+  uint32_t cropX = 0, cropY = 0, cropWidth = 0, cropHeight = 0;
+  uint16_t padding = 0; // Kept around the terrain in the cropped area
+};
+
+// A part of the cropped image, from its top left corner, in the buffer of the
+// render. Lines are `stride` bytes apart.
+struct Tile {
+  uint32_t x, y, width, height;
+  const uint8_t *pixels;
+  uint64_t stride;
+};
+
+struct Callbacks {
+  // Called once the size of the image is known, to get a buffer of
+  // width * height RGBA pixels owned by the caller, that the library clears.
+  // When not set or when returning nullptr, the library uses its own buffer
+  // for the render.
+  std::function<uint8_t *(uint32_t width, uint32_t height)> buffer;
+
+  // Called on the cropped image cut in tiles of tileSize pixels, from the top
+  // left, once the render is complete
+  std::function<void(const Tile &)> tile;
+  uint32_t tileSize = 256;
+
+  // Called when a part of the map was drawn, from any thread
+  std::function<void(uint64_t done, uint64_t total)> progress;
+
+  // Polled between the parts of the map; returning true stops the render
+  std::function<bool()> cancelled;
+};
+
+// Draw a map of the world. Returns false if the parameters are invalid or the
+// render was cancelled.
+bool render(const World &, const Parameters &, const Callbacks &, Image *);
+
+// Encode the cropped part of a rendered image
+bool savePNG(const std::filesystem::path &, const uint8_t *pixels,
+             const Image &);
+
+// Memory to use to keep regions and decompressed chunks between renders, in
+// bytes. By default, 512MiB of regions are kept, but not their chunks.
+void setCacheBudget(uint64_t bytes);
+
+// Silence the messages and progress bars of the renderer
+void setQuiet();
+
+} // namespace mcmap
+
+#endif // MCMAP_H_
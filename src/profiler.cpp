@@ -0,0 +1,191 @@
+#include "./profiler.h"
+#include "./logger.h"
+#include <cstring>
+#include <sys/resource.h>
+#ifndef DISABLE_OMP
+#include <omp.h>
+#endif
+
+namespace Profiler {
+
+bool enabled = false;
+
+std::vector<Record> records;
+timespec start;
+
+// The record selected by every thread, only valid for the records of the
+// same setup: threads do not know the records were replaced
+uint32_t generation = 0;
+thread_local Record *current = nullptr;
+thread_local uint32_t currentGeneration = 0;
+
+Record *selected() {
+  return currentGeneration == generation ? current : nullptr;
+}
+
+const char *phaseNames[] = {
+#define DEFINEPHASE(ID, STRING) STRING,
+#include "./phases.def"
+#undef DEFINEPHASE
+};
+
+const char *counterNames[] = {
+    "compressed_bytes", "inflated_bytes", "chunks", "sections", "blocks",
+};
+
+double elapsed(const timespec &from, const timespec &to) {
+  return double(to.tv_sec - from.tv_sec) +
+         double(to.tv_nsec - from.tv_nsec) / 1000000000.0;
+}
+
+void setup(const uint16_t splits) {
+  enabled = true;
+  generation++;
+  records.assign(splits + 1, Record());
+
+  for (uint16_t i = 0; i < splits; i++)
+    records[i].label = "split " + std::to_string(i);
+  records[splits].label = "output";
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+void reset() {
+  enabled = false;
+  generation++;
+  records.clear();
+  current = nullptr;
+}
+
+void select(const uint16_t record) {
+  if (!enabled || record >= records.size()) {
+    current = nullptr;
+    return;
+  }
+
+  current = &records[record];
+  currentGeneration = generation;
+#ifndef DISABLE_OMP
+  current->thread = omp_get_thread_num();
+#endif
+}
+
+void selectOutput() {
+  if (enabled)
+    select(records.size() - 1);
+}
+
+void count(const Counter counter, const uint64_t value) {
+  if (enabled && selected())
+    current->counters[counter] += value;
+}
+
+Timer::Timer(const Phase phase)
+    : phase(phase), active(enabled && selected()) {
+  if (!active)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+}
+
+Timer::~Timer() {
+  if (!active)
+    return;
+
+  timespec wallEnd, cpuEnd;
+  clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+
+  Timing &timing = current->phases[phase];
+  timing.wall += elapsed(wall, wallEnd);
+  timing.cpu += elapsed(cpu, cpuEnd);
+  timing.calls++;
+}
+
+json toJson(const Timing phases[PHASES], const uint64_t counters[COUNTERS]) {
+  json data = {{"phases", json::object()}, {"counters", json::object()}};
+
+  for (uint8_t phase = 0; phase < PHASES; phase++)
+    data["phases"][phaseNames[phase]] = {{"wall", phases[phase].wall},
+                                         {"cpu", phases[phase].cpu},
+                                         {"calls", phases[phase].calls}};
+
+  for (uint8_t counter = 0; counter < COUNTERS; counter++)
+    data["counters"][counterNames[counter]] = counters[counter];
+
+  return data;
+}
+
+json report() {
+  Timing total[PHASES];
+  uint64_t counters[COUNTERS] = {0};
+  json splits = json::array();
+
+  for (auto &record : records) {
+    json data = toJson(record.phases, record.counters);
+    data["label"] = record.label;
+    data["thread"] = record.thread;
+    splits.push_back(data);
+
+    for (uint8_t phase = 0; phase < PHASES; phase++) {
+      total[phase].wall += record.phases[phase].wall;
+      total[phase].cpu += record.phases[phase].cpu;
+      total[phase].calls += record.phases[phase].calls;
+    }
+
+    for (uint8_t counter = 0; counter < COUNTERS; counter++)
+      counters[counter] += record.counters[counter];
+  }
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  // Throughputs are computed against the time spent in the relevant phases,
+  // summed over all threads
+  auto rate = [](const double amount, const double time) {
+    return time > 0 ? amount / time : 0;
+  };
+
+  const double loading = total[REGION_IO].wall + total[INFLATE].wall +
+                         total[NBT_PARSE].wall + total[STRIP].wall;
+  const double rendering =
+      total[PALETTE].wall + total[DECODE].wall + total[DRAW].wall;
+
+  json data = toJson(total, counters);
+  data["wall"] = elapsed(start, now);
+  data["peak_rss_kb"] = usage.ru_maxrss;
+  data["throughput"] = {
+      {"inflate_in_mb_s",
+       rate(counters[COMPRESSED_BYTES] / 1048576.0, total[INFLATE].wall)},
+      {"inflate_out_mb_s",
+       rate(counters[INFLATED_BYTES] / 1048576.0, total[INFLATE].wall)},
+      {"parse_mb_s",
+       rate(counters[INFLATED_BYTES] / 1048576.0, total[NBT_PARSE].wall)},
+      {"chunks_s", rate(counters[CHUNKS], loading)},
+      {"blocks_s", rate(counters[BLOCKS], rendering)},
+  };
+  data["splits"] = splits;
+
+  return data;
+}
+
+bool save(const std::filesystem::path &file) {
+  FILE *f = fopen(file.c_str(), "w");
+
+  if (!f) {
+    logger::error("Opening profile file {} failed: {}\n", file.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  fmt::print(f, "{}\n", report().dump(2));
+  fclose(f);
+
+  return true;
+}
+
+} // namespace Profiler
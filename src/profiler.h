@@ -0,0 +1,79 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <filesystem>
+#include <json.hpp>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+using nlohmann::json;
+
+// Profiler
+// When enabled, records the wall and CPU time spent in every phase of the
+// rendering, for every split, along with the amount of data processed. Every
+// thread writes to the record it selected, so no locking is involved. When
+// disabled, timers only cost a branch.
+namespace Profiler {
+
+enum Phase {
+#define DEFINEPHASE(ID, STRING) ID,
+#include "./phases.def"
+#undef DEFINEPHASE
+  PHASES,
+};
+
+enum Counter {
+  COMPRESSED_BYTES, // Bytes read from the region files
+  INFLATED_BYTES,   // Bytes of NBT data after decompression
+  CHUNKS,           // Chunks loaded
+  SECTIONS,         // Sections rendered
+  BLOCKS,           // Blocks decoded
+  COUNTERS,
+};
+
+struct Timing {
+  double wall = 0, cpu = 0; // In seconds
+  uint64_t calls = 0;
+};
+
+struct Record {
+  std::string label;
+  int thread = 0;
+  Timing phases[PHASES];
+  uint64_t counters[COUNTERS] = {0};
+};
+
+extern bool enabled;
+
+void setup(const uint16_t splits);
+// Stop recording and drop the records, once a render is reported, for the
+// next render to start from nothing
+void reset();
+
+// Select the record the calling thread writes to: the splits are numbered
+// from 0, and the final steps (merge, crop, encode) use the last record
+void select(const uint16_t record);
+void selectOutput();
+
+void count(const Counter, const uint64_t);
+
+// Dump the results as json
+json report();
+bool save(const std::filesystem::path &);
+
+// Measure the time spent in a phase, from the construction of the timer to
+// its destruction
+struct Timer {
+  Phase phase;
+  bool active;
+  timespec wall, cpu;
+
+  Timer(const Phase);
+  ~Timer();
+};
+
+} // namespace Profiler
+
+#endif // PROFILER_H_
@@ -0,0 +1,204 @@
+#include "./regioncache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+Terrain::FileStamp::FileStamp(const struct stat &info)
+    : mtime(int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec),
+      size(info.st_size) {}
+
+Terrain::FileStamp
+Terrain::FileStamp::of(const std::filesystem::path &file) {
+  struct stat info;
+  if (stat(file.c_str(), &info))
+    return FileStamp();
+
+  return FileStamp(info);
+}
+
+Terrain::Region::Region(const std::filesystem::path &file, const int32_t x,
+                        const int32_t z)
+    : file(file), x(x), z(z), data(nullptr), size(0), mapped(false),
+      decodedSize(0) {
+  memset(offsets, 0, sizeof(offsets));
+
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    logger::error("Opening region file {} failed: {}\n", file.c_str(),
+                  strerror(errno));
+    return;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) || size_t(info.st_size) < REGION_HEADER_SIZE) {
+    logger::error("Region header too short in {}\n", file.c_str());
+    close(fd);
+    return;
+  }
+
+  size = info.st_size;
+  stamp = FileStamp(info);
+
+  // Map the file in memory. The pages are shared between all the users of the
+  // region, and only read when accessed.
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map != MAP_FAILED) {
+    data = static_cast<uint8_t *>(map);
+    mapped = true;
+  } else {
+    // Fall back to reading the whole file
+    data = new uint8_t[size];
+    if (pread(fd, data, size, 0) != ssize_t(size)) {
+      logger::error("Reading region file {} failed: {}\n", file.c_str(),
+                    strerror(errno));
+      delete[] data;
+      data = nullptr;
+      size = 0;
+    }
+  }
+
+  close(fd);
+
+  if (!data)
+    return;
+
+  // Parse the header (of size 4K) storing the chunks locations
+  for (uint16_t it = 0; it < REGIONSIZE * REGIONSIZE; it++)
+    offsets[it] = (_ntohl(data + it * 4) >> 8) * 4096;
+}
+
+Terrain::Region::~Region() {
+  if (mapped)
+    munmap(data, size);
+  else
+    delete[] data;
+}
+
+bool Terrain::Region::chunkData(const uint16_t index, const uint8_t **chunk,
+                                uint32_t *length, uint8_t *type) const {
+  const uint64_t offset = offsets[index];
+
+  // Check the 5 bytes that give the size and type of data are in the file
+  if (!offset || offset + 5 > size)
+    return false;
+
+  *length = _ntohl(data + offset);
+  (*length)--; // Sometimes the data is 1 byte smaller
+  *type = data[offset + 4];
+
+  if (offset + 5 + *length > size) {
+    logger::debug("Not enough data for chunk {} in {}\n", index,
+                  file.string());
+    return false;
+  }
+
+  *chunk = data + offset + 5;
+  return true;
+}
+
+std::shared_ptr<const Terrain::ChunkData>
+Terrain::Region::cached(const uint16_t index) const {
+  std::lock_guard<std::mutex> guard(decodedLock);
+  return decoded[index];
+}
+
+uint64_t Terrain::Region::footprint() const {
+  std::lock_guard<std::mutex> guard(decodedLock);
+  return size + decodedSize;
+}
+
+Terrain::RegionCache &Terrain::RegionCache::global() {
+  static RegionCache cache;
+  return cache;
+}
+
+void Terrain::RegionCache::setBudget(const uint64_t bytes, const bool chunks) {
+  std::lock_guard<std::mutex> guard(lock);
+  budget = bytes;
+  keepChunks = chunks;
+  evict(0);
+}
+
+std::shared_ptr<Terrain::Region>
+Terrain::RegionCache::open(const std::filesystem::path &file,
+                           const int32_t regionX, const int32_t regionZ) {
+  const FileStamp stamp = FileStamp::of(file);
+  std::lock_guard<std::mutex> guard(lock);
+
+  auto cached = index.find(file.string());
+  if (cached != index.end()) {
+    if ((*cached->second)->stamp == stamp) {
+      // Move the region to the front of the list
+      regions.splice(regions.begin(), regions, cached->second);
+      return *cached->second;
+    }
+
+    // The file was written to: drop the region with its decompressed chunks,
+    // to open it again
+    used -= (*cached->second)->footprint();
+    regions.erase(cached->second);
+    index.erase(cached);
+  }
+
+  auto region = std::make_shared<Region>(file, regionX, regionZ);
+  if (!region->valid())
+    return nullptr;
+
+  evict(region->size);
+
+  regions.push_front(region);
+  index[file.string()] = regions.begin();
+  used += region->size;
+
+  return region;
+}
+
+void Terrain::RegionCache::store(Region &region, const uint16_t chunk,
+                                 const uint8_t *data, const uint64_t length) {
+  if (!keepChunks)
+    return;
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  // The region is not counted in the cache anymore if it was replaced
+  auto cached = index.find(region.file.string());
+  if (cached == index.end() || cached->second->get() != &region)
+    return;
+
+  evict(length);
+  if (used + length > budget)
+    return;
+
+  std::lock_guard<std::mutex> regionGuard(region.decodedLock);
+  if (region.decoded[chunk])
+    return;
+
+  region.decoded[chunk] = std::make_shared<ChunkData>(data, data + length);
+  region.decodedSize += length;
+  used += length;
+}
+
+void Terrain::RegionCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  const uint64_t saved = budget;
+
+  budget = 0;
+  evict(0);
+  budget = saved;
+}
+
+void Terrain::RegionCache::evict(const uint64_t needed) {
+  auto it = regions.end();
+
+  while (used + needed > budget && it != regions.begin()) {
+    --it;
+
+    // Regions in use are not dropped
+    if (it->use_count() > 1)
+      continue;
+
+    used -= (*it)->footprint();
+    index.erase((*it)->file.string());
+    it = regions.erase(it);
+  }
+}
@@ -0,0 +1,130 @@
+#ifndef REGIONCACHE_H_
+#define REGIONCACHE_H_
+
+#include "./helper.h"
+#include "./logger.h"
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+namespace Terrain {
+
+typedef std::vector<uint8_t> ChunkData;
+
+// File stamp
+// The modification time and size of a file, telling if it was written to
+// since it was read
+struct FileStamp {
+  int64_t mtime; // In nanoseconds, -1 if the file does not exist
+  uint64_t size;
+
+  FileStamp() : mtime(-1), size(0) {}
+  FileStamp(const struct stat &);
+
+  // The stamp of a file, or an empty stamp if it does not exist
+  static FileStamp of(const std::filesystem::path &);
+
+  bool exists() const { return mtime >= 0; }
+
+  bool operator==(const FileStamp &other) const {
+    return mtime == other.mtime && size == other.size;
+  }
+  bool operator!=(const FileStamp &other) const { return !(*this == other); }
+};
+
+// Region file
+// A region file mapped in memory, with its header parsed. The region is
+// opened once through the cache below and shared by all its users; the
+// decompressed chunks can also be kept to avoid inflating them again.
+struct Region {
+  std::filesystem::path file;
+  int32_t x, z;
+  FileStamp stamp; // The state of the file when it was opened
+
+  uint8_t *data; // The contents of the file
+  size_t size;   // The size of the file
+  bool mapped;   // Wether the data is mapped, or read into memory
+
+  // The offset in bytes of every chunk's data, 0 if the chunk does not exist
+  uint32_t offsets[REGIONSIZE * REGIONSIZE];
+
+  // The chunks decompressed, if kept
+  std::shared_ptr<const ChunkData> decoded[REGIONSIZE * REGIONSIZE];
+  uint64_t decodedSize;
+  mutable std::mutex decodedLock;
+
+  Region(const std::filesystem::path &, const int32_t, const int32_t);
+  ~Region();
+
+  Region(const Region &) = delete;
+  Region &operator=(const Region &) = delete;
+
+  bool valid() const { return data != nullptr; }
+
+  // Get the compressed data of a chunk from its index in the region, along
+  // with its compression type. Returns false if the chunk does not exist or
+  // its data is out of the file.
+  bool chunkData(const uint16_t index, const uint8_t **, uint32_t *,
+                 uint8_t *) const;
+
+  // Get a chunk decompressed earlier, or nullptr if it was not kept
+  std::shared_ptr<const ChunkData> cached(const uint16_t index) const;
+
+  // Memory used by this region
+  uint64_t footprint() const;
+};
+
+// Region cache
+// A process-wide cache of the regions opened. Regions are reference counted:
+// they stay alive as long as someone uses them, and are kept afterwards in a
+// least-recently-used list until the memory budget is exceeded. A region
+// whose file changed is opened again, its current users keeping the contents
+// they started with.
+struct RegionCache {
+  std::mutex lock;
+
+  // Most recently used regions first
+  std::list<std::shared_ptr<Region>> regions;
+  std::unordered_map<std::string,
+                     std::list<std::shared_ptr<Region>>::iterator>
+      index;
+
+  uint64_t budget, used;
+  bool keepChunks; // Wether to keep the decompressed chunks
+
+  RegionCache() : budget(512 * uint64_t(1024 * 1024)), used(0) {
+    keepChunks = false;
+  }
+
+  // The instance shared by the whole process
+  static RegionCache &global();
+
+  void setBudget(const uint64_t bytes, const bool chunks);
+
+  // Get a region from the cache, opening it if it is not there or if its file
+  // changed since. Returns nullptr if the file cannot be opened.
+  std::shared_ptr<Region> open(const std::filesystem::path &, const int32_t,
+                               const int32_t);
+
+  // Keep a decompressed chunk in its region, if the budget allows it and the
+  // region was not replaced in the cache
+  void store(Region &, const uint16_t, const uint8_t *, const uint64_t);
+
+  // Drop all the unused regions
+  void clear();
+
+private:
+  // Drop unused regions from the end of the list to fit in the budget. The
+  // lock must be held.
+  void evict(const uint64_t needed);
+};
+
+} // namespace Terrain
+
+#endif // REGIONCACHE_H_
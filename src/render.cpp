@@ -0,0 +1,284 @@
+#include "./render.h"
+#include "./draw_png.h"
+#include "./heatmap.h"
+#include "./logger.h"
+#include "./profiler.h"
+#include "./topdown.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+
+namespace Render {
+
+// The colors to draw with, without the blocks the options hide
+Colors::Palette drawingColors(const Settings::WorldOptions &options,
+                              const Colors::Palette &colors) {
+  Colors::Palette palette = colors;
+
+  // Overwrite water if asked to
+  // TODO expand this to other blocks
+  if (options.hideWater)
+    palette["minecraft:water"] = Colors::Block();
+  if (options.hideBeacons)
+    palette["mcmap:beacon_beam"] = Colors::Block();
+
+  return palette;
+}
+
+// Fit the coordinates of a split to the chunks loaded in it, for its canvases
+// to only cover them. Returns false if no chunk was loaded.
+bool fitSplit(const Terrain::Data &world, Terrain::Coordinates *coords) {
+  if (world.chunks.empty())
+    return false;
+
+  int32_t minX = INT32_MAX, maxX = INT32_MIN, minZ = INT32_MAX,
+          maxZ = INT32_MIN;
+
+  for (auto &chunk : world.chunks) {
+    minX = std::min(minX, Terrain::keyX(chunk.first));
+    maxX = std::max(maxX, Terrain::keyX(chunk.first));
+    minZ = std::min(minZ, Terrain::keyZ(chunk.first));
+    maxZ = std::max(maxZ, Terrain::keyZ(chunk.first));
+  }
+
+  // Chunks are aligned on the cells of every scale
+  coords->minX = std::max(coords->minX, minX << 4);
+  coords->maxX = std::min(coords->maxX, (maxX << 4) + 15);
+  coords->minZ = std::max(coords->minZ, minZ << 4);
+  coords->maxZ = std::min(coords->maxZ, (maxZ << 4) + 15);
+
+  // Cap the height to avoid having a ridiculous image height
+  coords->minY = std::max(coords->minY, world.minHeight());
+  coords->maxY = std::min(coords->maxY, world.maxHeight());
+
+  return true;
+}
+
+// The buffers of the canvases of every view, of the splits and of the final
+// images, kept by every thread from a canvas to the next and from a render to
+// the next, as the inflate buffers of the chunks are
+thread_local std::vector<CanvasBuffer> splitBuffers, finalBuffers;
+
+// Render the sub-regions, one per split, and merge them in order in the
+// final canvases. Every split is loaded once, then drawn in the orientation of
+// every final canvas. The view is either the isometric or the top-down canvas.
+// Returns false if the drawing was cancelled.
+template <typename View>
+bool renderSplits(const std::vector<std::unique_ptr<View>> &finalCanvases,
+                  Settings::WorldOptions &options,
+                  const Colors::Palette &colors,
+                  Terrain::Coordinates *subCoords, const Hooks &hooks) {
+  const std::filesystem::path regionDir = options.regionDir();
+  std::atomic<bool> cancelled(false);
+  uint16_t done = 0;
+
+#ifndef DISABLE_OMP
+#pragma omp parallel shared(finalCanvases, cancelled, done)
+#endif
+  {
+    if (splitBuffers.size() < finalCanvases.size())
+      splitBuffers.resize(finalCanvases.size());
+
+#ifndef DISABLE_OMP
+#pragma omp for ordered schedule(static)
+#endif
+    for (uint16_t i = 0; i < options.splits; i++) {
+      // Once cancelled, the remaining splits are skipped
+      if (cancelled || (hooks.cancelled && hooks.cancelled())) {
+        cancelled = true;
+        continue;
+      }
+
+      Profiler::select(i);
+
+      // Load the minecraft terrain to render
+      Terrain::Data world(subCoords[i]);
+      world.surfaceDepth = options.surfaceDepth;
+      world.load(regionDir, &options.existing);
+
+      // Draw the terrain fragment, in every orientation, on canvases fitting
+      // the terrain loaded. A split without any chunk is not drawn.
+      std::vector<std::unique_ptr<View>> canvases;
+
+      if (fitSplit(world, &subCoords[i])) {
+        // Pre-cache the colors used in the part of the world loaded to
+        // squeeze a few milliseconds of color lookup
+        Colors::Palette localColors;
+        Colors::filter(colors, world.cache, &localColors);
+
+        // Beacon beams go over the terrain, up to the top of the 13th section
+        uint8_t top = subCoords[i].maxY;
+        if (!options.hideBeacons &&
+            std::find(world.cache.begin(), world.cache.end(),
+                      "minecraft:beacon") != world.cache.end())
+          top = std::max(top, uint8_t((13 << 4) - 1));
+
+        for (size_t view = 0; view < finalCanvases.size(); view++) {
+          Terrain::Coordinates oriented = subCoords[i];
+          oriented.orientation = finalCanvases[view]->map.orientation;
+
+          const Canvas::Allocator allocator = splitBuffers[view].allocator();
+
+          if constexpr (std::is_same<View, IsometricCanvas>::value)
+            canvases.emplace_back(new View(oriented, localColors, 0,
+                                           options.scale, allocator, top));
+          else
+            canvases.emplace_back(
+                new View(oriented, localColors, 0, options.scale, allocator));
+          View &canvas = *canvases.back();
+
+          canvas.shading = options.shading;
+          if constexpr (std::is_same<View, IsometricCanvas>::value) {
+            canvas.setMarkers(&options.markers);
+            if (options.heatmap)
+              canvas.enableHeatmap();
+          }
+          canvas.renderTerrain(world);
+        }
+      }
+
+#ifndef DISABLE_OMP
+#pragma omp ordered
+#endif
+      {
+        // Merge the terrain fragments into the final canvases. The ordered
+        // directive in the pragma is primordial, as the merging algorithm
+        // cannot merge terrain when not in order.
+        for (size_t view = 0; view < canvases.size(); view++) {
+          finalCanvases[view]->merge(*canvases[view]);
+          splitBuffers[view].release(*canvases[view]);
+        }
+
+        if (hooks.progress)
+          hooks.progress(++done, options.splits);
+      }
+    }
+  }
+
+  return !cancelled;
+}
+
+// Split the map and draw it in the final canvases
+template <typename View>
+bool drawViews(const std::vector<std::unique_ptr<View>> &finalCanvases,
+               Settings::WorldOptions &options, const Colors::Palette &colors,
+               const Hooks &hooks) {
+  // Prepare the sub-regions to render
+  // This could be bypassed when the program is run in single-threaded mode, but
+  // it works just fine when run in single threaded, so why bother making huge
+  // if-elses ?
+  Terrain::Coordinates *subCoords = new Terrain::Coordinates[options.splits];
+  splitCoords(options.boundaries, subCoords, options.splits, options.scale);
+
+  const bool drawn =
+      renderSplits(finalCanvases, options, colors, subCoords, hooks);
+
+  delete[] subCoords;
+
+  // The beams of the markers go over the terrain of all the splits
+  if constexpr (std::is_same<View, IsometricCanvas>::value)
+    if (drawn)
+      for (auto &finalCanvas : finalCanvases)
+        finalCanvas->renderBeams();
+
+  return drawn;
+}
+
+// Create a final canvas for every orientation to render, draw them, and save
+// the images
+template <typename View>
+bool renderViews(Settings::WorldOptions &options,
+                 const Colors::Palette &colors) {
+  std::vector<Orientation> orientations = {options.boundaries.orientation};
+  if (options.allOrientations)
+    orientations = {NW, SW, NE, SE};
+
+  // These are the canvases on which the final images will be rendered
+  std::vector<std::unique_ptr<View>> finalCanvases;
+
+  if (finalBuffers.size() < orientations.size())
+    finalBuffers.resize(orientations.size());
+
+  for (auto orientation : orientations) {
+    Terrain::Coordinates oriented = options.boundaries;
+    oriented.orientation = orientation;
+
+    finalCanvases.emplace_back(
+        new View(oriented, colors, options.padding, options.scale,
+                 finalBuffers[finalCanvases.size()].allocator()));
+
+    if constexpr (std::is_same<View, IsometricCanvas>::value)
+      if (options.heatmap)
+        finalCanvases.back()->enableHeatmap();
+  }
+
+  drawViews(finalCanvases, options, colors, Hooks());
+
+  Profiler::selectOutput();
+  bool saved = true;
+
+  for (auto &finalCanvas : finalCanvases) {
+    const std::filesystem::path file =
+        options.outputFile(finalCanvas->map.orientation);
+    saved = PNG::Image(file, finalCanvas.get()).save() && saved;
+
+    if constexpr (std::is_same<View, IsometricCanvas>::value)
+      if (options.heatmap)
+        saved = Heatmap::save(*finalCanvas->heatmap, *finalCanvas, file) &&
+                saved;
+  }
+
+  for (size_t view = 0; view < finalCanvases.size(); view++)
+    finalBuffers[view].release(*finalCanvases[view]);
+
+  return saved;
+}
+
+bool render(Settings::WorldOptions &options, const Colors::Palette &colors) {
+  const Colors::Palette palette = drawingColors(options, colors);
+
+  if (!options.profileFile.empty())
+    Profiler::setup(options.splits);
+
+  bool saved;
+  if (options.topdown)
+    saved = renderViews<TopDownCanvas>(options, palette);
+  else
+    saved = renderViews<IsometricCanvas>(options, palette);
+
+  if (!options.profileFile.empty())
+    saved = Profiler::save(options.profileFile) && saved;
+
+  return saved;
+}
+
+// Draw a single view of the map, in a canvas of the given type
+template <typename View>
+std::unique_ptr<Canvas> drawView(Settings::WorldOptions &options,
+                                 const Colors::Palette &colors,
+                                 const Hooks &hooks,
+                                 const Canvas::Allocator &allocator) {
+  std::vector<std::unique_ptr<View>> finalCanvases;
+  finalCanvases.emplace_back(new View(options.boundaries, colors,
+                                      options.padding, options.scale,
+                                      allocator));
+
+  if (!drawViews(finalCanvases, options, colors, hooks))
+    return nullptr;
+
+  return std::move(finalCanvases.front());
+}
+
+std::unique_ptr<Canvas> draw(Settings::WorldOptions &options,
+                             const Colors::Palette &colors, const Hooks &hooks,
+                             const Canvas::Allocator &allocator) {
+  const Colors::Palette palette = drawingColors(options, colors);
+
+  if (options.topdown)
+    return drawView<TopDownCanvas>(options, palette, hooks, allocator);
+
+  return drawView<IsometricCanvas>(options, palette, hooks, allocator);
+}
+
+} // namespace Render
@@ -0,0 +1,36 @@
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#include "./canvas.h"
+#include "./colors.h"
+#include "./settings.h"
+#include <functional>
+#include <memory>
+
+// Render
+// Draw a map from its options: the terrain is loaded split by split, drawn in
+// every orientation asked and merged, then the images are saved. Returns false
+// if an image could not be written.
+namespace Render {
+
+bool render(Settings::WorldOptions &, const Colors::Palette &);
+
+// Ways for a caller to follow a drawing and stop it. Both are called between
+// splits, from the rendering threads.
+struct Hooks {
+  // Called with the number of splits merged, and the total
+  std::function<void(uint64_t, uint64_t)> progress;
+  // Returns true to abandon the drawing
+  std::function<bool()> cancelled;
+};
+
+// Draw the map in the orientation of the boundaries, without saving it. The
+// buffer of the canvas comes from the allocator when given. Returns nullptr if
+// the drawing was cancelled.
+std::unique_ptr<Canvas> draw(Settings::WorldOptions &, const Colors::Palette &,
+                             const Hooks &,
+                             const Canvas::Allocator & = nullptr);
+
+} // namespace Render
+
+#endif // RENDER_H_
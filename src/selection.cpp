@@ -0,0 +1,131 @@
+#include "./selection.h"
+#include <png.h>
+
+bool Selection::load(const std::filesystem::path &file,
+                     Terrain::ChunkSet *selection) {
+  json data;
+
+  FILE *f = fopen(file.c_str(), "r");
+  if (!f) {
+    logger::error("Could not open selection file {}: {}\n", file.c_str(),
+                  strerror(errno));
+    return false;
+  }
+
+  try {
+    data = json::parse(f);
+  } catch (const nlohmann::detail::parse_error &err) {
+    logger::error("Parsing selection file {} failed: {}\n", file.c_str(),
+                  err.what());
+    fclose(f);
+    return false;
+  }
+
+  fclose(f);
+
+  try {
+    if (data.contains("chunks"))
+      addChunks(data["chunks"], selection);
+
+    if (data.contains("polygons"))
+      for (auto &polygon : data["polygons"])
+        addPolygon(polygon.get<Polygon>(), selection);
+
+    if (data.contains("bitmap")) {
+      // The bitmap path is relative to the selection file
+      std::filesystem::path bitmap =
+          file.parent_path() / data["bitmap"]["file"].get<std::string>();
+      auto origin = data["bitmap"]["origin"].get<std::pair<int32_t, int32_t>>();
+
+      if (!addBitmap(bitmap, origin.first, origin.second, selection))
+        return false;
+    }
+  } catch (const nlohmann::detail::exception &err) {
+    logger::error("Invalid selection file {}: {}\n", file.c_str(), err.what());
+    return false;
+  }
+
+  logger::debug("Selected {} chunks from {}\n", selection->count(),
+                file.c_str());
+
+  return true;
+}
+
+void Selection::addChunks(const json &list, Terrain::ChunkSet *selection) {
+  for (auto &chunk : list) {
+    auto coordinates = chunk.get<std::pair<int32_t, int32_t>>();
+    selection->insert(coordinates.first, coordinates.second);
+  }
+}
+
+void Selection::addPolygon(const Polygon &polygon,
+                           Terrain::ChunkSet *selection) {
+  if (polygon.size() < 3) {
+    logger::warn("Ignoring polygon with less than 3 vertices\n");
+    return;
+  }
+
+  int32_t minX = std::numeric_limits<int32_t>::max(), minZ = minX;
+  int32_t maxX = std::numeric_limits<int32_t>::min(), maxZ = maxX;
+
+  for (auto &vertex : polygon) {
+    minX = std::min(minX, vertex.first);
+    maxX = std::max(maxX, vertex.first);
+    minZ = std::min(minZ, vertex.second);
+    maxZ = std::max(maxZ, vertex.second);
+  }
+
+  // A chunk is selected when its center is inside the polygon. The test used
+  // is the even-odd rule: a ray cast from the point crosses the edges of the
+  // polygon an odd number of times if the point is inside.
+  for (int32_t chunkX = CHUNK(minX); chunkX <= CHUNK(maxX); chunkX++) {
+    for (int32_t chunkZ = CHUNK(minZ); chunkZ <= CHUNK(maxZ); chunkZ++) {
+      const double x = (chunkX << 4) + 8, z = (chunkZ << 4) + 8;
+      bool inside = false;
+
+      for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const double xi = polygon[i].first, zi = polygon[i].second;
+        const double xj = polygon[j].first, zj = polygon[j].second;
+
+        if ((zi > z) != (zj > z) && x < (xj - xi) * (z - zi) / (zj - zi) + xi)
+          inside = !inside;
+      }
+
+      if (inside)
+        selection->insert(chunkX, chunkZ);
+    }
+  }
+}
+
+bool Selection::addBitmap(const std::filesystem::path &file,
+                          const int32_t originX, const int32_t originZ,
+                          Terrain::ChunkSet *selection) {
+  png_image image;
+  memset(&image, 0, sizeof(png_image));
+  image.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_file(&image, file.c_str())) {
+    logger::error("Reading bitmap {} failed: {}\n", file.c_str(),
+                  image.message);
+    return false;
+  }
+
+  // Read the image as gray and alpha values, two bytes per pixel
+  image.format = PNG_FORMAT_GA;
+  std::vector<uint8_t> pixels(PNG_IMAGE_SIZE(image));
+
+  if (!png_image_finish_read(&image, NULL, pixels.data(), 0, NULL)) {
+    logger::error("Reading bitmap {} failed: {}\n", file.c_str(),
+                  image.message);
+    return false;
+  }
+
+  for (uint32_t z = 0; z < image.height; z++)
+    for (uint32_t x = 0; x < image.width; x++) {
+      const uint8_t *pixel = &pixels[(x + z * image.width) * 2];
+      if (pixel[0] && pixel[1])
+        selection->insert(originX + x, originZ + z);
+    }
+
+  return true;
+}
@@ -0,0 +1,41 @@
+#ifndef SELECTION_H_
+#define SELECTION_H_
+
+#include "./helper.h"
+#include "./logger.h"
+#include "./worldloader.h"
+#include <filesystem>
+#include <json.hpp>
+#include <utility>
+#include <vector>
+
+using nlohmann::json;
+
+// Selection of chunks to render
+// A selection file is a json object, whose fields describe areas to render.
+// All the areas are added together, and the chunks they cover are the only
+// ones loaded and rendered:
+//
+// {
+//   "chunks": [[X, Z], ...],              // A list of chunk coordinates
+//   "polygons": [[[x, z], ...], ...],     // Polygons, in block coordinates
+//   "bitmap": {                           // A PNG image, one pixel per chunk
+//     "file": "claims.png",               // Non-black opaque pixels are kept
+//     "origin": [X, Z]                    // Chunk of the top left pixel
+//   }
+// }
+
+namespace Selection {
+
+typedef std::vector<std::pair<int32_t, int32_t>> Polygon;
+
+bool load(const std::filesystem::path &, Terrain::ChunkSet *);
+
+void addChunks(const json &, Terrain::ChunkSet *);
+void addPolygon(const Polygon &, Terrain::ChunkSet *);
+bool addBitmap(const std::filesystem::path &, const int32_t, const int32_t,
+               Terrain::ChunkSet *);
+
+} // namespace Selection
+
+#endif // SELECTION_H_
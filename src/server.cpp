@@ -0,0 +1,627 @@
+/**
+ * This file contains the tile server: the sockets, the parsing of the requests
+ * and their translation into renders
+ */
+
+#include "./server.h"
+#include "./logger.h"
+#include "./render.h"
+#include <csignal>
+#include <netinet/in.h>
+#include <png.h>
+#include <queue>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#ifndef DISABLE_OMP
+#include <omp.h>
+#endif
+
+namespace Server {
+
+TileCache::Tile TileCache::get(const std::string &key,
+                               const std::string &version,
+                               const std::function<Tile()> &render) {
+  std::unique_lock<std::mutex> guard(lock);
+
+  // Wait for the tile if another request is rendering it
+  while (true) {
+    auto cached = index.find(key);
+    if (cached != index.end()) {
+      if (cached->second->version == version) {
+        tiles.splice(tiles.begin(), tiles, cached->second);
+        return cached->second->tile;
+      }
+
+      // The tile was drawn from regions that changed since
+      used -= cached->second->tile->size();
+      tiles.erase(cached->second);
+      index.erase(cached);
+    }
+
+    if (!pending.count(key))
+      break;
+
+    rendered.wait(guard);
+  }
+
+  pending.insert(key);
+  guard.unlock();
+
+  Tile tile;
+  try {
+    tile = render();
+  } catch (...) {
+    guard.lock();
+    pending.erase(key);
+    rendered.notify_all();
+    throw;
+  }
+
+  guard.lock();
+  pending.erase(key);
+
+  if (tile) {
+    tiles.push_front({key, version, tile});
+    index[key] = tiles.begin();
+    used += tile->size();
+
+    // Drop the least recently used tiles, keeping at least the new one
+    while (used > budget && tiles.size() > 1) {
+      used -= tiles.back().tile->size();
+      index.erase(tiles.back().key);
+      tiles.pop_back();
+    }
+  }
+
+  rendered.notify_all();
+  return tile;
+}
+
+namespace {
+
+// The number of pixels on each side of a tile
+const int32_t TILEPIXELS = 256;
+
+const char *orientations[] = {"nw", "sw", "ne", "se"};
+
+struct State {
+  const Settings::WorldOptions &options;
+  const Colors::Palette &colors;
+
+  TileCache cache;
+
+  // The chunks of the regions read in the directory of every dimension, with
+  // the state of the files when they were read
+  struct Scan {
+    Terrain::FileStamp directory;
+    std::map<uint64_t, std::pair<Terrain::FileStamp,
+                                 Terrain::ChunkSet::RegionBitmap>>
+        regions;
+  };
+
+  std::mutex scansLock;
+  std::map<std::filesystem::path, Scan> scans;
+
+  // The connections waiting for a worker
+  std::mutex queueLock;
+  std::condition_variable queued;
+  std::queue<int> connections;
+  bool stopping = false;
+
+  State(const Settings::WorldOptions &options, const Colors::Palette &colors)
+      : options(options), colors(colors), cache(options.tileBudget) {}
+
+  // Get the chunks existing in a range of chunks of a region directory, and
+  // the version of the regions holding them. The regions written to since they
+  // were read are read again, and all of them when files were added to or
+  // removed from the directory. Returns false if the directory does not exist.
+  bool scan(const std::filesystem::path &dir, const Coordinates &chunks,
+            Terrain::ChunkSet *existing, std::string *version) {
+    const Terrain::FileStamp directory = Terrain::FileStamp::of(dir);
+    if (!directory.exists())
+      return false;
+
+    std::vector<std::pair<Terrain::FileStamp, std::filesystem::path>> files;
+    for (int32_t rx = REGION(chunks.minX); rx <= REGION(chunks.maxX); rx++)
+      for (int32_t rz = REGION(chunks.minZ); rz <= REGION(chunks.maxZ); rz++) {
+        const std::filesystem::path file =
+            dir / fmt::format("r.{}.{}.mca", rx, rz);
+        files.emplace_back(Terrain::FileStamp::of(file), file);
+      }
+
+    std::lock_guard<std::mutex> guard(scansLock);
+    Scan &scan = scans[dir];
+
+    if (scan.directory != directory) {
+      scan.directory = directory;
+      scan.regions.clear();
+    }
+
+    auto file = files.begin();
+    for (int32_t rx = REGION(chunks.minX); rx <= REGION(chunks.maxX); rx++)
+      for (int32_t rz = REGION(chunks.minZ); rz <= REGION(chunks.maxZ);
+           rz++, file++) {
+        const Terrain::FileStamp &stamp = file->first;
+        const uint64_t key = Terrain::chunkKey(rx, rz);
+        auto read = scan.regions.find(key);
+
+        if (read == scan.regions.end() || read->second.first != stamp) {
+          if (!stamp.exists()) {
+            if (read != scan.regions.end())
+              scan.regions.erase(read);
+            continue;
+          }
+
+          // Read the header of the region through the cache, where the
+          // render will find it
+          Terrain::ChunkSet::RegionBitmap bitmap;
+          std::shared_ptr<Terrain::Region> region =
+              Terrain::RegionCache::global().open(file->second, rx, rz);
+
+          for (uint16_t chunk = 0; region && chunk < bitmap.size(); chunk++)
+            bitmap.set(chunk, region->offsets[chunk] != 0);
+
+          read = scan.regions
+                     .insert_or_assign(key, std::make_pair(stamp, bitmap))
+                     .first;
+        }
+
+        if (read->second.second.any())
+          existing->regions[key] = read->second.second;
+
+        version->append(
+            fmt::format("{}.{}:{}.{};", rx, rz, stamp.mtime, stamp.size));
+      }
+
+    return true;
+  }
+};
+
+bool sendAll(const int client, const void *data, size_t length) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+  while (length) {
+    const ssize_t sent = send(client, bytes, length, 0);
+    if (sent <= 0)
+      return false;
+
+    bytes += sent;
+    length -= sent;
+  }
+
+  return true;
+}
+
+void respond(const int client, const char *status, const char *type,
+             const void *body, const size_t length) {
+  const std::string header =
+      fmt::format("HTTP/1.1 {}\r\nContent-Type: {}\r\nContent-Length: "
+                  "{}\r\nConnection: close\r\n\r\n",
+                  status, type, length);
+
+  if (sendAll(client, header.data(), header.size()))
+    sendAll(client, body, length);
+}
+
+void respond(const int client, const char *status) {
+  respond(client, status, "text/plain", status, strlen(status));
+}
+
+// Read a request up to the end of its headers, and get its method and path
+bool readRequest(const int client, std::string *method, std::string *path) {
+  std::string request;
+  char buffer[4096];
+
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.find("\n\n") == std::string::npos) {
+    const ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+    if (received <= 0 || request.size() > 16 * sizeof(buffer))
+      return false;
+
+    request.append(buffer, received);
+  }
+
+  std::istringstream line(request.substr(0, request.find_first_of("\r\n")));
+  line >> *method >> *path;
+
+  return !method->empty() && !path->empty();
+}
+
+// Get the options to render the tile asked for in a path, its position in
+// tiles and its key in the cache
+bool parseTile(const std::string &path, const Settings::WorldOptions &base,
+               Settings::WorldOptions *opts, int32_t *x, int32_t *y,
+               std::string *key) {
+  std::vector<std::string> parts;
+  std::istringstream stream(path.substr(0, path.find('?')));
+  std::string part;
+
+  while (std::getline(stream, part, '/'))
+    parts.push_back(part);
+
+  // The path starts with a slash, hence the empty first part
+  if (parts.size() != 6 || !parts[0].empty() || parts[1].empty())
+    return false;
+
+  std::string &tileY = parts[5];
+  if (tileY.size() < 5 || tileY.compare(tileY.size() - 4, 4, ".png"))
+    return false;
+  tileY.resize(tileY.size() - 4);
+
+  uint8_t orientation = 0;
+  while (orientation < 4 && parts[2] != orientations[orientation])
+    orientation++;
+
+  if (orientation == 4 || parts[3].size() != 1 || parts[3][0] < '0' ||
+      parts[3][0] > '3')
+    return false;
+
+  const uint8_t zoom = parts[3][0] - '0';
+
+  // The tiles stay within 2^27 pixels of the origin, past the image of a world
+  // of 30 million blocks on each side
+  const int32_t limit = (1 << 27) / TILEPIXELS;
+
+  for (const std::string *coordinate : {&parts[4], &tileY})
+    if (coordinate->empty() || coordinate->size() > 10 ||
+        !isNumeric(coordinate->c_str()) ||
+        std::abs(std::stoll(*coordinate)) > limit)
+      return false;
+
+  *x = std::stoi(parts[4]), *y = std::stoi(tileY);
+
+  *opts = base;
+  opts->dim = Settings::Dimension(parts[1]);
+  opts->boundaries.orientation = Orientation(orientation);
+  opts->scale = zoom;
+
+  // Tiles are drawn whole, on the worker's thread
+  opts->padding = 0;
+  opts->splits = 1;
+  opts->allOrientations = opts->heatmap = false;
+
+  *key = fmt::format("{}/{}/{}/{}/{}", opts->dim.to_string(),
+                     orientations[orientation], zoom, *x, *y);
+
+  return true;
+}
+
+// The part of the image of the world in a tile, and the chunks that can draw
+// into it
+struct TileArea {
+  // The ranges of u - v and u + v of the cells drawn into the tile in the
+  // isometric view, or of u and v in the top-down view
+  int64_t diffMin, diffMax, sumMin, sumMax;
+
+  // The chunks holding those cells
+  Coordinates chunks;
+
+  TileArea(const int32_t, const int32_t, const Settings::WorldOptions &);
+};
+
+TileArea::TileArea(const int32_t x, const int32_t y,
+                   const Settings::WorldOptions &opts) {
+  const Orientation o = opts.boundaries.orientation;
+  const uint8_t scale = opts.scale;
+  const int64_t left = int64_t(x) * TILEPIXELS, right = left + TILEPIXELS - 1,
+                top = int64_t(y) * TILEPIXELS, bottom = top + TILEPIXELS - 1;
+
+  // The cell u v at the height h is drawn from the pixel 2(u - v), u + v - 3h,
+  // on 4 columns and 5 lines at most, the beams of the beacons going up to the
+  // 13th section. In the top-down view, the cell is the pixel u v.
+  diffMin = left, diffMax = right, sumMin = top, sumMax = bottom;
+  const int64_t lowest = opts.boundaries.minY >> scale,
+                highest = std::max<int64_t>(opts.boundaries.maxY, 207);
+
+  if (!opts.topdown) {
+    diffMin = (left - 3) >> 1, diffMax = right >> 1;
+    sumMin = top - 4 + lowest * 3, sumMax = bottom + (highest >> scale) * 3;
+  }
+
+  // The cells of the tile hold in this range of each axis
+  int64_t uMin = diffMin, uMax = diffMax, vMin = sumMin, vMax = sumMax;
+  if (!opts.topdown)
+    uMin = (sumMin + diffMin) >> 1, uMax = (sumMax + diffMax + 1) >> 1,
+    vMin = (sumMin - diffMax) >> 1, vMax = (sumMax - diffMin + 1) >> 1;
+
+  // The reverse orientation gets the cells of the world back: the two
+  // orientations turning the map are the reverse of each other
+  const Orientation reverse = o == NE ? SW : (o == SW ? NE : o);
+  int32_t x0, z0, x1, z1;
+  orientCell(reverse, uMin, vMin, &x0, &z0);
+  orientCell(reverse, uMax, vMax, &x1, &z1);
+
+  chunks.minX = CHUNK(int64_t(std::min(x0, x1)) << scale);
+  chunks.maxX = CHUNK(int64_t(std::max(x0, x1)) << scale);
+  chunks.minZ = CHUNK(int64_t(std::min(z0, z1)) << scale);
+  chunks.maxZ = CHUNK(int64_t(std::max(z0, z1)) << scale);
+}
+
+// Find the chunks drawing into the area of a tile, among the chunks existing,
+// and set the boundaries of the render to hold them. Returns false if there
+// are none.
+bool tileChunks(const TileArea &area, const Terrain::ChunkSet &existing,
+                Settings::WorldOptions *opts) {
+  const Orientation o = opts->boundaries.orientation;
+  const uint8_t scale = opts->scale;
+  const int64_t diffMin = area.diffMin, diffMax = area.diffMax,
+                sumMin = area.sumMin, sumMax = area.sumMax;
+
+  Terrain::ChunkSet chunks;
+  Coordinates extent;
+  extent.setUndefined();
+
+  for (int32_t cx = area.chunks.minX; cx <= area.chunks.maxX; cx++)
+    for (int32_t cz = area.chunks.minZ; cz <= area.chunks.maxZ; cz++) {
+      if (!existing.contains(cx, cz))
+        continue;
+
+      // The cells of the chunk on both axes of the image
+      int32_t u0, v0, u1, v1;
+      orientCell(o, (cx << 4) >> scale, (cz << 4) >> scale, &u0, &v0);
+      orientCell(o, ((cx << 4) + 15) >> scale, ((cz << 4) + 15) >> scale, &u1,
+                 &v1);
+      const int64_t lowU = std::min(u0, u1), highU = std::max(u0, u1),
+                    lowV = std::min(v0, v1), highV = std::max(v0, v1);
+
+      const bool inside =
+          opts->topdown
+              ? highU >= diffMin && lowU <= diffMax && highV >= sumMin &&
+                    lowV <= sumMax
+              : highU - lowV >= diffMin && lowU - highV <= diffMax &&
+                    highU + highV >= sumMin && lowU + lowV <= sumMax;
+
+      if (!inside)
+        continue;
+
+      chunks.insert(cx, cz);
+      extent.minX = std::min(extent.minX, cx << 4);
+      extent.maxX = std::max(extent.maxX, (cx << 4) + 15);
+      extent.minZ = std::min(extent.minZ, cz << 4);
+      extent.maxZ = std::max(extent.maxZ, (cz << 4) + 15);
+    }
+
+  if (extent.isUndefined())
+    return false;
+
+  opts->boundaries.minX = extent.minX;
+  opts->boundaries.maxX = extent.maxX;
+  opts->boundaries.minZ = extent.minZ;
+  opts->boundaries.maxZ = extent.maxZ;
+  opts->existing = std::move(chunks);
+
+  return true;
+}
+
+// The buffer of the canvas of the tiles drawn by every worker
+thread_local CanvasBuffer tileBuffer;
+
+// Draw the chunks of a tile, and encode the pixels of the tile x y
+TileCache::Tile renderTile(Settings::WorldOptions &opts,
+                           const Colors::Palette &colors, const int32_t x,
+                           const int32_t y) {
+  std::unique_ptr<Canvas> canvas = Render::draw(
+      opts, colors, Render::Hooks(), tileBuffer.allocator());
+  if (!canvas)
+    return nullptr;
+
+  // Copy the part of the canvas inside the tile, the rest staying transparent
+  int64_t originX, originY;
+  canvas->imageOrigin(&originX, &originY);
+
+  const int64_t left = int64_t(x) * TILEPIXELS - originX,
+                top = int64_t(y) * TILEPIXELS - originY;
+  const int64_t first = std::max<int64_t>(left, 0),
+                last = std::min<int64_t>(left + TILEPIXELS, canvas->width);
+
+  std::vector<uint8_t> pixels(TILEPIXELS * TILEPIXELS * BYTESPERPIXEL, 0);
+
+  for (int64_t line = std::max<int64_t>(top, 0);
+       first < last &&
+       line < std::min<int64_t>(top + TILEPIXELS, canvas->height);
+       line++)
+    memcpy(&pixels[((line - top) * TILEPIXELS + first - left) * BYTESPERPIXEL],
+           canvas->pixel(first, line), (last - first) * BYTESPERPIXEL);
+
+  tileBuffer.release(*canvas);
+
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  image.format = PNG_FORMAT_RGBA;
+  image.width = TILEPIXELS;
+  image.height = TILEPIXELS;
+
+  // Encode in a buffer large enough for any image of this size, shrunk after
+  png_alloc_size_t size = PNG_IMAGE_PNG_SIZE_MAX(image);
+  auto encoded = std::make_shared<std::vector<uint8_t>>(size);
+
+  if (!png_image_write_to_memory(&image, encoded->data(), &size, 0,
+                                 pixels.data(), 0, nullptr)) {
+    logger::error("Encoding tile failed: {}\n", image.message);
+    return nullptr;
+  }
+
+  encoded->resize(size);
+  return encoded;
+}
+
+void handle(State &state, const int client) {
+  std::string method, path, key;
+  Settings::WorldOptions opts;
+
+  if (!readRequest(client, &method, &path))
+    return;
+
+  if (method != "GET") {
+    respond(client, "405 Method Not Allowed");
+    return;
+  }
+
+  int32_t x, y;
+  if (!parseTile(path, state.options, &opts, &x, &y, &key)) {
+    respond(client, "400 Bad Request");
+    return;
+  }
+
+  // Tiles without any chunk are not rendered
+  const TileArea area(x, y, opts);
+  Terrain::ChunkSet existing;
+  std::string version;
+
+  if (!state.scan(opts.regionDir(), area.chunks, &existing, &version) ||
+      !tileChunks(area, existing, &opts)) {
+    respond(client, "404 Not Found");
+    return;
+  }
+
+  TileCache::Tile tile;
+
+  try {
+    tile = state.cache.get(key, version, [&]() {
+      return renderTile(opts, state.colors, x, y);
+    });
+  } catch (const std::exception &err) {
+    logger::error("Rendering tile {} failed: {}\n", key, err.what());
+  }
+
+  if (!tile) {
+    respond(client, "500 Internal Server Error");
+    return;
+  }
+
+  respond(client, "200 OK", "image/png", tile->data(), tile->size());
+}
+
+// Open the socket to listen on: a local port, or a Unix socket at the path
+// given
+int listenOn(const std::string &address) {
+  int server = -1, reuse = 1;
+  bool bound = false;
+
+  if (isNumeric(address.c_str())) {
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(atoi(address.c_str()));
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    server = socket(AF_INET, SOCK_STREAM, 0);
+    bound = server >= 0 &&
+            !setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                        sizeof(reuse)) &&
+            !bind(server, (sockaddr *)&local, sizeof(local));
+  } else {
+    sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+
+    if (address.size() >= sizeof(local.sun_path)) {
+      logger::error("Socket path {} is too long\n", address);
+      return -1;
+    }
+
+    strcpy(local.sun_path, address.c_str());
+    unlink(address.c_str());
+
+    server = socket(AF_UNIX, SOCK_STREAM, 0);
+    bound = server >= 0 && !bind(server, (sockaddr *)&local, sizeof(local));
+  }
+
+  if (!bound || listen(server, SOMAXCONN)) {
+    logger::error("Cannot listen on {}: {}\n", address, strerror(errno));
+    if (server >= 0)
+      close(server);
+    return -1;
+  }
+
+  return server;
+}
+
+} // namespace
+
+bool serve(const Settings::WorldOptions &options,
+           const Colors::Palette &colors) {
+  const int server = listenOn(options.serveAddress);
+  if (server < 0)
+    return false;
+
+  // Clients closing their connection early must not stop the server
+  signal(SIGPIPE, SIG_IGN);
+
+  State state(options, colors);
+
+  // A worker per thread, unless their number is given
+  const uint16_t count =
+      options.workers
+          ? options.workers
+          : std::max(std::thread::hardware_concurrency(), uint32_t(1));
+  std::vector<std::thread> workers;
+
+  for (uint16_t i = 0; i < count; i++)
+    workers.emplace_back([&state]() {
+#ifndef DISABLE_OMP
+      // Every tile is a single split, rendered on the worker's thread
+      omp_set_num_threads(1);
+#endif
+
+      while (true) {
+        int client;
+
+        {
+          std::unique_lock<std::mutex> guard(state.queueLock);
+          state.queued.wait(guard, [&state]() {
+            return state.stopping || !state.connections.empty();
+          });
+
+          if (state.connections.empty())
+            return;
+
+          client = state.connections.front();
+          state.connections.pop();
+        }
+
+        handle(state, client);
+        close(client);
+      }
+    });
+
+  logger::info("Serving {} on {} with {} workers\n", options.saveName.c_str(),
+               options.serveAddress, count);
+
+  // The progress bars of the renders would interleave
+  logger::setQuiet();
+
+  while (true) {
+    const int client = accept(server, nullptr, nullptr);
+
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+
+      logger::error("Accepting connections failed: {}\n", strerror(errno));
+      break;
+    }
+
+    std::lock_guard<std::mutex> guard(state.queueLock);
+    state.connections.push(client);
+    state.queued.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(state.queueLock);
+    state.stopping = true;
+    state.queued.notify_all();
+  }
+
+  for (auto &worker : workers)
+    worker.join();
+
+  close(server);
+  return false;
+}
+
+} // namespace Server
@@ -0,0 +1,74 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "./colors.h"
+#include "./settings.h"
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Tile server
+// Render the world on demand, for web maps. The server answers HTTP requests
+// on a local port, or on a Unix socket when given a path:
+//
+//   GET /DIMENSION/ORIENTATION/ZOOM/X/Y.png
+//
+// DIMENSION is a namespaced ID like on the command line, ORIENTATION one of
+// nw, ne, se or sw, and ZOOM goes from 0 to 3. Tiles are squares of 256
+// pixels of the image of the whole world drawn at the scale 1/2^ZOOM, the tile
+// X Y starting at the pixel X * 256, Y * 256 of the image. The image is
+// anchored on the world: the top left corner of the block 0 0 at the height 0
+// is at its origin. Each tile draws the chunks drawn into it, then keeps its
+// own pixels, so that neighbouring tiles join.
+//
+// The regions and their decompressed chunks are kept in the region cache, and
+// the encoded tiles in a cache of their own. Connections are handled by a pool
+// of workers, rendering the tiles missing from the cache. The world can change
+// while it is served: the region files under a tile are checked at every
+// request, the tile being drawn again from the regions written to since.
+namespace Server {
+
+// Encoded tiles, kept while they fit in the memory budget, the least recently
+// used ones being dropped first. The requests for a tile being rendered wait
+// for it instead of rendering it again. Every tile is kept with a version,
+// telling the state of the regions it was drawn from: a tile asked for with
+// another version is rendered again.
+struct TileCache {
+  typedef std::shared_ptr<const std::vector<uint8_t>> Tile;
+
+  struct Entry {
+    std::string key, version;
+    Tile tile;
+  };
+
+  std::mutex lock;
+  std::condition_variable rendered;
+
+  // Most recently used tiles first
+  std::list<Entry> tiles;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  std::set<std::string> pending; // The tiles being rendered
+
+  uint64_t budget, used;
+
+  TileCache(const uint64_t budget) : budget(budget), used(0) {}
+
+  // Get a tile, rendering it if it is not in the cache with this version.
+  // Failed renders return nullptr and are not cached.
+  Tile get(const std::string &key, const std::string &version,
+           const std::function<Tile()> &render);
+};
+
+// Listen and answer requests until the process is stopped. Returns false if
+// the server could not start.
+bool serve(const Settings::WorldOptions &, const Colors::Palette &);
+
+} // namespace Server
+
+#endif // SERVER_H_
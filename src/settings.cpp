@@ -1,9 +1,11 @@
 #include "./settings.h"
+#include "./selection.h"
 #include "logger.h"
 
 #define ISPATH(p) (!(p).empty() && std::filesystem::exists((p)))
 
-bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
+bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts,
+                         ScanCache *scans) {
 #define MOREARGS(x) (argpos + (x) < argc)
 #define NEXTARG argv[++argpos]
 #define POLLARG(x) argv[argpos + (x)]
@@ -48,18 +50,55 @@ bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
       }
       opts->splits = atoi(NEXTARG);
 #endif
+    } else if (strcmp(option, "-cache") == 0) {
+      if (!MOREARGS(1) || !isNumeric(POLLARG(1)) || atoi(POLLARG(1)) < 0) {
+        logger::error("{} needs an positive integer argument\n", option);
+        return false;
+      }
+      opts->cacheBudget = atoi(NEXTARG) * uint64_t(1024 * 1024);
+      opts->keepChunks = true;
     } else if (strcmp(option, "-padding") == 0) {
       if (!MOREARGS(1) || !isNumeric(POLLARG(1)) || atoi(POLLARG(1)) < 0) {
         logger::error("{} needs an positive integer argument\n", option);
         return false;
       }
       opts->padding = atoi(NEXTARG);
+    } else if (strcmp(option, "-scale") == 0) {
+      if (!MOREARGS(1)) {
+        logger::error("{} needs a scale: 1/2, 1/4 or 1/8\n", option);
+        return false;
+      }
+
+      const char *scale = NEXTARG;
+      if (strcmp(scale, "1") == 0 || strcmp(scale, "1/1") == 0) {
+        opts->scale = 0;
+      } else if (strcmp(scale, "1/2") == 0) {
+        opts->scale = 1;
+      } else if (strcmp(scale, "1/4") == 0) {
+        opts->scale = 2;
+      } else if (strcmp(scale, "1/8") == 0) {
+        opts->scale = 3;
+      } else {
+        logger::error("Invalid scale {}: use 1/2, 1/4 or 1/8\n", scale);
+        return false;
+      }
+    } else if (strcmp(option, "-surface-depth") == 0) {
+      if (!MOREARGS(1) || !isNumeric(POLLARG(1)) || atoi(POLLARG(1)) < 1 ||
+          atoi(POLLARG(1)) > 255) {
+        logger::error("{} needs a depth between 1 and 255\n", option);
+        return false;
+      }
+      opts->surfaceDepth = atoi(NEXTARG);
     } else if (strcmp(option, "-nowater") == 0) {
       opts->hideWater = true;
     } else if (strcmp(option, "-nobeacons") == 0) {
       opts->hideBeacons = true;
     } else if (strcmp(option, "-shading") == 0) {
       opts->shading = true;
+    } else if (strcmp(option, "-topdown") == 0) {
+      opts->topdown = true;
+    } else if (strcmp(option, "-heatmap") == 0) {
+      opts->heatmap = true;
     } else if (strcmp(option, "-nether") == 0) {
       opts->dim = Dimension("the_nether");
     } else if (strcmp(option, "-end") == 0) {
@@ -87,6 +126,49 @@ bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
         logger::error("File {} does not exist\n", opts->colorFile.c_str());
         return false;
       }
+    } else if (strcmp(option, "-select") == 0) {
+      if (!MOREARGS(1)) {
+        logger::error("{} needs one argument\n", option);
+        return false;
+      }
+      opts->selectionFile = NEXTARG;
+      if (!ISPATH(opts->selectionFile)) {
+        logger::error("File {} does not exist\n", opts->selectionFile.c_str());
+        return false;
+      }
+    } else if (strcmp(option, "-profile") == 0) {
+      if (!MOREARGS(1)) {
+        logger::error("{} needs one argument\n", option);
+        return false;
+      }
+      opts->profileFile = NEXTARG;
+    } else if (strcmp(option, "-batch") == 0) {
+      if (!MOREARGS(1) || !ISPATH(std::filesystem::path(POLLARG(1)))) {
+        logger::error("{} needs an existing job file\n", option);
+        return false;
+      }
+      opts->mode = Settings::BATCH;
+      opts->batchFile = NEXTARG;
+    } else if (strcmp(option, "-serve") == 0) {
+      if (!MOREARGS(1)) {
+        logger::error("{} needs a port or a socket path\n", option);
+        return false;
+      }
+      opts->mode = Settings::SERVE;
+      opts->serveAddress = NEXTARG;
+    } else if (strcmp(option, "-tilecache") == 0) {
+      if (!MOREARGS(1) || !isNumeric(POLLARG(1)) || atoi(POLLARG(1)) < 0) {
+        logger::error("{} needs an positive integer argument\n", option);
+        return false;
+      }
+      opts->tileBudget = atoi(NEXTARG) * uint64_t(1024 * 1024);
+    } else if (strcmp(option, "-workers") == 0) {
+      if (!MOREARGS(1) || !isNumeric(POLLARG(1)) || atoi(POLLARG(1)) < 1 ||
+          atoi(POLLARG(1)) > UINT16_MAX) {
+        logger::error("{} needs a positive integer argument\n", option);
+        return false;
+      }
+      opts->workers = atoi(NEXTARG);
     } else if (strcmp(option, "-dumpcolors") == 0) {
       opts->mode = Settings::DUMPCOLORS;
     } else if (strcmp(option, "-marker") == 0) {
@@ -95,8 +177,21 @@ bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
         return false;
       }
       int x = atoi(NEXTARG), z = atoi(NEXTARG);
-      opts->markers[opts->totalMarkers++] =
-          Colors::Marker(x, z, std::string(NEXTARG));
+      opts->markers.add(Colors::Marker(x, z, std::string(NEXTARG)));
+    } else if (strcmp(option, "-markers") == 0) {
+      if (!MOREARGS(1)) {
+        logger::error("{} needs one argument\n", option);
+        return false;
+      }
+      const std::filesystem::path file = NEXTARG;
+      if (!ISPATH(file)) {
+        logger::error("File {} does not exist\n", file.c_str());
+        return false;
+      }
+      if (!Markers::load(file, &opts->markers))
+        return false;
+    } else if (strcmp(option, "-allorientations") == 0) {
+      opts->allOrientations = true;
     } else if (strcmp(option, "-nw") == 0) {
       opts->boundaries.orientation = NW;
     } else if (strcmp(option, "-sw") == 0) {
@@ -121,6 +216,11 @@ bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
     }
   }
 
+  if (opts->mode == SERVE && !ISPATH(opts->saveName)) {
+    logger::error("Nothing to serve: no world given\n");
+    return false;
+  }
+
   if (opts->mode == RENDER) {
     // Check if the given save posesses the required dimension, must be done now
     // as the world path can be given after the dimension name, which messes up
@@ -136,9 +236,35 @@ bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
     }
 
     // Scan the region directory and map the existing terrain in this set of
-    // coordinates
+    // coordinates. When given a cache, a directory is only scanned once.
     Coordinates existingWorld;
-    scanWorldDirectory(opts->regionDir(), &existingWorld);
+
+    if (scans && scans->scans.count(opts->regionDir())) {
+      const ScanCache::Scan &scan = scans->scans[opts->regionDir()];
+      existingWorld = scan.extent;
+      opts->existing = scan.existing;
+    } else {
+      scanWorldDirectory(opts->regionDir(), &existingWorld, &opts->existing);
+      if (scans)
+        scans->scans[opts->regionDir()] = {existingWorld, opts->existing};
+    }
+
+    if (!opts->selectionFile.empty()) {
+      Terrain::ChunkSet selection;
+      if (!Selection::load(opts->selectionFile, &selection))
+        return false;
+
+      // Only the selected chunks are considered from now on, and the map is
+      // restricted to the area they cover
+      opts->existing.intersect(selection);
+
+      if (!opts->existing.count()) {
+        logger::error("Nothing to render: no existing chunk is selected\n");
+        return false;
+      }
+
+      opts->existing.extent(&existingWorld);
+    }
 
     if (opts->boundaries.isUndefined()) {
       // No boundaries were defined, import the whole existing world
@@ -163,7 +289,14 @@ bool Settings::parseArgs(int argc, char **argv, Settings::WorldOptions *opts) {
       return false;
     }
 
-    int64_t length = opts->boundaries.maxX - opts->boundaries.minX + 1;
+    if (opts->topdown && opts->heatmap) {
+      logger::warn("The heatmaps are only recorded on the isometric view\n");
+      opts->heatmap = false;
+    }
+
+    // At a reduced scale, splits are made of whole cells
+    int64_t length = (opts->boundaries.maxX >> opts->scale) -
+                     (opts->boundaries.minX >> opts->scale) + 1;
     if (opts->splits > length) {
       logger::error("Cannot split terrain in more than {} units.\n", length);
       return false;
@@ -3,9 +3,11 @@
 
 #include "./colors.h"
 #include "./helper.h"
+#include "./markers.h"
 #include "./worldloader.h"
 #include <cstdint>
 #include <filesystem>
+#include <map>
 #include <string>
 #define UNDEFINED 0x7FFFFFFF
 
@@ -43,35 +45,66 @@ struct Dimension {
   string to_string() { return fmt::format("{}:{}", ns, id); };
 };
 
-enum actions { RENDER, DUMPCOLORS };
+enum actions { RENDER, DUMPCOLORS, BATCH, SERVE };
+
+// The terrain found in the region directories scanned, by directory. Jobs
+// rendering the same world share it instead of reading the headers again.
+struct ScanCache {
+  struct Scan {
+    Coordinates extent;
+    Terrain::ChunkSet existing;
+  };
+
+  std::map<std::filesystem::path, Scan> scans;
+};
 
 struct WorldOptions {
   // Execution mode
   int mode;
 
   // Files to use
-  std::filesystem::path saveName, outFile, colorFile;
+  std::filesystem::path saveName, outFile, colorFile, selectionFile;
+  std::filesystem::path profileFile; // Profiling is enabled if set
+  std::filesystem::path batchFile;   // The job list in batch mode
+  std::string serveAddress; // The port or socket to listen on when serving
 
   // Map boundaries
   Dimension dim;
   std::string customDim;
   Coordinates boundaries;
+  Terrain::ChunkSet existing; // Chunks present in the region directory
   uint16_t splits;
 
   // Image settings
   uint16_t padding; // Should be enough
   bool hideWater, hideBeacons, shading;
+  bool topdown; // Render the map seen from above instead of isometric
+  bool allOrientations; // Render the four orientations, in as many images
+  uint8_t scale; // Draw a block for every cell of 2^scale blocks on each side
+  uint8_t surfaceDepth; // Only draw the blocks this deep in the columns, if set
+  bool heatmap; // Save debug heatmaps of the drawing next to the image
 
   // Marker storage
-  uint8_t totalMarkers;
-  Colors::Marker markers[256];
+  Markers::Store markers;
+
+  // Region cache settings: memory budget and wether to keep decompressed
+  // chunks to share them between splits
+  uint64_t cacheBudget;
+  bool keepChunks;
+
+  // Memory budget of the rendered tiles when serving, and the number of
+  // requests handled at once, a worker for every thread if 0
+  uint64_t tileBudget;
+  uint16_t workers;
 
   // Memory limits, legacy code for image splitting
   int offsetY;
   uint64_t memlimit;
   bool memlimitSet, wholeworld;
 
-  WorldOptions() : mode(RENDER), saveName(""), colorFile(""), dim("overworld") {
+  WorldOptions()
+      : mode(RENDER), saveName(""), colorFile(""), selectionFile(""),
+        profileFile(""), dim("overworld") {
     outFile = "output.png";
 
     splits = 1;
@@ -81,9 +114,14 @@ struct WorldOptions {
 
     offsetY = 3;
     hideWater = hideBeacons = shading = false;
+    topdown = allOrientations = heatmap = false;
     padding = 5;
+    scale = surfaceDepth = 0;
 
-    totalMarkers = 0;
+    cacheBudget = 512 * uint64_t(1024 * 1024);
+    keepChunks = false;
+    tileBudget = 256 * uint64_t(1024 * 1024);
+    workers = 0;
 
     wholeworld = false;
     memlimit = 2000 * uint64_t(1024 * 1024);
@@ -91,9 +129,22 @@ struct WorldOptions {
   }
 
   std::filesystem::path regionDir() { return dim.regionDir(saveName); }
+
+  // The image of an orientation: when rendering all of them, the name of the
+  // orientation is appended to the file's name
+  std::filesystem::path outputFile(const Orientation orientation) const {
+    if (!allOrientations)
+      return outFile;
+
+    const char *names[] = {"nw", "sw", "ne", "se"};
+    return outFile.parent_path() /
+           fmt::format("{}.{}{}", outFile.stem().string(), names[orientation],
+                       outFile.extension().string());
+  }
 };
 
-bool parseArgs(int argc, char **argv, Settings::WorldOptions *opts);
+bool parseArgs(int argc, char **argv, Settings::WorldOptions *opts,
+               ScanCache *scans = nullptr);
 
 } // namespace Settings
 
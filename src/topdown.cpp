@@ -0,0 +1,360 @@
+/**
+ * This file contains functions to draw the terrain seen from above
+ */
+
+#include "./topdown.h"
+#include <cmath>
+
+TopDownCanvas::TopDownCanvas(const Terrain::Coordinates &coords,
+                             const Colors::Palette &colors,
+                             const uint16_t padding, const uint8_t scale,
+                             const Allocator &allocator)
+    : Canvas(coords, padding, allocator), scale(scale) {
+  // At a reduced scale, the sizes count cells, aligned on the world grid
+  sizeX = (map.maxX >> scale) - (map.minX >> scale) + 1;
+  sizeZ = (map.maxZ >> scale) - (map.minZ >> scale) + 1;
+
+  // The map is rotated by a quarter turn for the orientations with an axis
+  // swapped
+  if (map.orientation == NW || map.orientation == SE) {
+    width = sizeX + this->padding * 2;
+    height = sizeZ + this->padding * 2;
+  } else {
+    width = sizeZ + this->padding * 2;
+    height = sizeX + this->padding * 2;
+  }
+
+  allocate();
+
+  palette = colors;
+  shading = false;
+}
+
+void TopDownCanvas::position(const int32_t x, const int32_t z,
+                             uint32_t &pixelX, uint32_t &pixelY) const {
+  switch (map.orientation) {
+  case NW:
+    pixelX = (x >> scale) - (map.minX >> scale);
+    pixelY = (z >> scale) - (map.minZ >> scale);
+    break;
+  case NE:
+    pixelX = (z >> scale) - (map.minZ >> scale);
+    pixelY = (map.maxX >> scale) - (x >> scale);
+    break;
+  case SE:
+    pixelX = (map.maxX >> scale) - (x >> scale);
+    pixelY = (map.maxZ >> scale) - (z >> scale);
+    break;
+  case SW:
+    pixelX = (map.maxZ >> scale) - (z >> scale);
+    pixelY = (x >> scale) - (map.minX >> scale);
+    break;
+  }
+
+  pixelX += padding;
+  pixelY += padding;
+}
+
+void TopDownCanvas::imageOrigin(int64_t *x, int64_t *y) const {
+  // A pixel per cell, the cells of opposite corners giving the first column
+  // and line
+  int32_t u0, v0, u1, v1;
+  orientCell(map.orientation, map.minX >> scale, map.minZ >> scale, &u0, &v0);
+  orientCell(map.orientation, map.maxX >> scale, map.maxZ >> scale, &u1, &v1);
+
+  *x = int64_t(std::min(u0, u1)) - padding;
+  *y = int64_t(std::min(v0, v1)) - padding;
+}
+
+void TopDownCanvas::merge(const TopDownCanvas &subCanvas) {
+  Profiler::Timer timer(Profiler::MERGE);
+
+  // Every column has its own pixel, so the sub-canvas is copied where its
+  // columns are, in any order
+  uint32_t subX = 0, subY = 0, x = 0, y = 0;
+
+  for (int32_t blockX = subCanvas.map.minX; blockX <= subCanvas.map.maxX;
+       blockX++)
+    for (int32_t blockZ = subCanvas.map.minZ; blockZ <= subCanvas.map.maxZ;
+         blockZ++) {
+      subCanvas.position(blockX, blockZ, subX, subY);
+      position(blockX, blockZ, x, y);
+
+      const uint8_t *source =
+          subCanvas.bytesBuffer +
+          (subX + uint64_t(subY) * subCanvas.width) * BYTESPERPIXEL;
+
+      if (x < width && y < height && source[PALPHA]) {
+        memcpy(pixel(x, y), source, BYTESPERPIXEL);
+        markDrawn(x, y, x, y);
+      }
+    }
+}
+
+void TopDownCanvas::renderTerrain(const Terrain::Data &world) {
+  uint64_t index = 0;
+
+  for (auto &chunk : world.chunks) {
+    renderChunk(world, Terrain::keyX(chunk.first), Terrain::keyZ(chunk.first));
+    logger::printProgress("Rendering chunks", index++, world.chunks.size());
+  }
+}
+
+namespace {
+
+// The blocks of a section, decoded one at a time when needed, with their
+// colors resolved on the first access to the section
+struct SectionReader {
+  const std::vector<NBT> *palette = nullptr;
+  const std::vector<int64_t> *blockStates = nullptr;
+  uint32_t bitLength = 0;
+  std::vector<const Colors::Block *> colors;
+  bool loaded = false;
+};
+
+// The color of a block seen from above: the accent of the blocks drawn with
+// a different top
+const Colors::Color &topColor(const Colors::Block *block,
+                              const NBT &metadata) {
+  if (block->type == Colors::BlockTypes::drawGrown)
+    return block->secondary;
+
+  if (block->type == Colors::BlockTypes::drawLog &&
+      !(metadata.contains("Properties") &&
+        metadata["Properties"].contains("axis") &&
+        metadata["Properties"]["axis"].get<string>() != "y"))
+    return block->secondary;
+
+  return block->primary;
+}
+
+} // namespace
+
+void TopDownCanvas::renderChunk(const Terrain::Data &terrain,
+                                const int32_t chunkX, const int32_t chunkZ) {
+  const NBT &chunk = terrain.chunkAt(chunkX, chunkZ);
+  const uint8_t maxHeight = terrain.maxHeight(chunkX, chunkZ);
+
+  if (chunk.is_end() || !terrain.heightAt(chunkX, chunkZ))
+    return;
+
+  const bool post116 = chunk["DataVersion"].get<int>() >= 2534;
+  const sectionInterpreter blockAt = post116 ? blockAtPost116 : blockAtPre116;
+
+  const std::vector<NBT> *sections =
+      chunk["Level"]["Sections"].get<const std::vector<NBT> *>();
+
+  // The height maps give the highest block of every column, and the floor
+  // under the water. When they are missing, the columns are searched from
+  // the top of the chunk.
+  uint16_t surface[256], oceanFloor[256];
+  bool hasSurface = false, hasFloor = false;
+
+  if (chunk["Level"].contains("Heightmaps")) {
+    const NBT &heightmaps = chunk["Level"]["Heightmaps"];
+
+    if (heightmaps.contains("WORLD_SURFACE"))
+      hasSurface = decodeHeightmap(
+          heightmaps["WORLD_SURFACE"].get<const std::vector<int64_t> *>(),
+          post116, surface);
+
+    if (heightmaps.contains("OCEAN_FLOOR"))
+      hasFloor = decodeHeightmap(
+          heightmaps["OCEAN_FLOOR"].get<const std::vector<int64_t> *>(),
+          post116, oceanFloor);
+  }
+
+  Profiler::Timer timer(Profiler::DRAW);
+
+  SectionReader readers[16];
+  Colors::Block fallback;
+
+  // Get the color of a block, and its palette entry for the metadata
+  auto colorAt = [&](const uint8_t x, const uint8_t z, const uint8_t y,
+                     const NBT **metadata) -> const Colors::Block * {
+    SectionReader &reader = readers[y >> 4];
+
+    if (!reader.loaded) {
+      reader.loaded = true;
+      const NBT &section =
+          (y >> 4) < sections->size() ? (*sections)[y >> 4] : minecraft_air;
+
+      if (section.is_end() || !section.contains("Palette"))
+        return nullptr;
+
+      reader.palette = section["Palette"].get<const std::vector<NBT> *>();
+      reader.blockStates =
+          section["BlockStates"].get<const std::vector<int64_t> *>();
+      reader.bitLength = std::max(
+          uint32_t(ceil(log2(reader.palette->size()))), uint32_t(4));
+
+      if (reader.palette->size() > 4096 ||
+          reader.blockStates->size() <
+              statesLength(reader.bitLength, post116)) {
+        logger::error("Invalid section in chunk {} {}\n", chunkX, chunkZ);
+        reader.palette = nullptr;
+        return nullptr;
+      }
+
+      Profiler::Timer timer(Profiler::PALETTE);
+      Profiler::count(Profiler::SECTIONS, 1);
+
+      for (auto &block : *reader.palette) {
+        const string namespacedId = block["Name"].get<string>();
+        auto defined = palette.find(namespacedId);
+
+        if (defined == palette.end()) {
+          logger::error("Color of block {} not found\n", namespacedId);
+          reader.colors.push_back(&fallback);
+        } else {
+          reader.colors.push_back(&defined->second);
+        }
+      }
+    }
+
+    if (!reader.palette)
+      return nullptr;
+
+    Profiler::count(Profiler::BLOCKS, 1);
+    const uint16_t index =
+        blockAt(reader.bitLength, reader.blockStates, x, z, y);
+
+    if (index >= reader.colors.size())
+      return nullptr;
+
+    *metadata = &(*reader.palette)[index];
+    return reader.colors[index];
+  };
+
+  const uint8_t minX = std::max(map.minX - (chunkX << 4), 0),
+                maxX = std::min(map.maxX - (chunkX << 4), 15),
+                minZ = std::max(map.minZ - (chunkZ << 4), 0),
+                maxZ = std::min(map.maxZ - (chunkZ << 4), 15);
+
+  // Water is drawn with the depth under it instead of block by block
+  auto waterColor = palette.find("minecraft:water");
+  const Colors::Block *water =
+      waterColor == palette.end() ? nullptr : &waterColor->second;
+  const NBT *metadata = nullptr;
+  uint32_t pixelX = 0, pixelY = 0;
+
+  // The color seen from above and the highest block of every column
+  Colors::Color columns[256];
+  uint8_t heights[256];
+
+  for (uint8_t z = minZ; z < maxZ + 1; z++) {
+    for (uint8_t x = minX; x < maxX + 1; x++) {
+      const uint16_t column = x + z * 16;
+
+      // The surface height map is the height over the highest block
+      int32_t y = hasSurface ? surface[column] - 1 : maxHeight;
+      y = std::min(y, int32_t(map.maxY));
+
+      // The blocks are composited from the top: every block is drawn under
+      // the ones already seen, and the search stops on an opaque block
+      float rgb[3] = {0, 0, 0}, alpha = 0;
+      int32_t top = -1;
+
+      auto composite = [&](const Colors::Color &color, const float opacity) {
+        const float weight = (1 - alpha) * opacity;
+        rgb[0] += weight * color.R;
+        rgb[1] += weight * color.G;
+        rgb[2] += weight * color.B;
+        alpha += weight;
+      };
+
+      while (y >= map.minY && alpha < 254.5f / 255) {
+        const Colors::Block *block = colorAt(x, z, y, &metadata);
+
+        if (!block || block->primary.transparent() ||
+            block->type == Colors::BlockTypes::drawHidden) {
+          y--;
+          continue;
+        }
+
+        if (top < 0)
+          top = y;
+
+        if (block != water) {
+          composite(topColor(block, *metadata), block->primary.ALPHA / 255.0f);
+          y--;
+          continue;
+        }
+
+        // Water: find the first block under it, directly from the height map
+        // when possible. The light going through `depth` blocks of water
+        // decreases geometrically, hence the opacity of the whole run.
+        int32_t floor = y - 1;
+        if (hasFloor && oceanFloor[column] && oceanFloor[column] - 1 < y)
+          floor = oceanFloor[column] - 1;
+        else
+          while (floor >= map.minY && colorAt(x, z, floor, &metadata) == block)
+            floor--;
+        floor = std::max(floor, int32_t(map.minY) - 1);
+
+        composite(water->primary,
+                  1 - pow(1 - water->primary.ALPHA / 255.0f, y - floor));
+        y = floor;
+      }
+
+      if (top < 0 || alpha == 0)
+        continue;
+
+      Colors::Color &color = columns[column];
+      color.R = clamp(int32_t(rgb[0] / alpha + .5f));
+      color.G = clamp(int32_t(rgb[1] / alpha + .5f));
+      color.B = clamp(int32_t(rgb[2] / alpha + .5f));
+      color.ALPHA = clamp(int32_t(alpha * 255 + .5f));
+      heights[column] = top;
+    }
+  }
+
+  // Draw the columns; at a reduced scale, a pixel stands for a cell of
+  // 2^scale columns on each side, and gets the most common color among them
+  const uint8_t side = 1 << scale, mask = ~(side - 1);
+
+  for (uint8_t cellZ = minZ & mask; cellZ < maxZ + 1; cellZ += side) {
+    for (uint8_t cellX = minX & mask; cellX < maxX + 1; cellX += side) {
+      const uint8_t fromX = std::max(cellX, minX),
+                    toX = std::min(uint8_t(cellX + side - 1), maxX),
+                    fromZ = std::max(cellZ, minZ),
+                    toZ = std::min(uint8_t(cellZ + side - 1), maxZ);
+      int16_t best = -1;
+      uint8_t bestCount = 0;
+
+      for (uint8_t z = fromZ; z < toZ + 1; z++)
+        for (uint8_t x = fromX; x < toX + 1; x++) {
+          const Colors::Color &color = columns[x + z * 16];
+          if (color.transparent())
+            continue;
+
+          uint8_t occurrences = 0;
+          for (uint8_t j = fromZ; j < toZ + 1; j++)
+            for (uint8_t i = fromX; i < toX + 1; i++)
+              occurrences +=
+                  !memcmp(&columns[i + j * 16], &color, BYTESPERPIXEL);
+
+          if (occurrences > bestCount) {
+            best = x + z * 16;
+            bestCount = occurrences;
+          }
+        }
+
+      if (best < 0)
+        continue;
+
+      Colors::Color color = columns[best];
+
+      // The same profile as the isometric view, from the highest block
+      if (shading) {
+        const float profile = -100 + 200 * float(heights[best]) / 255;
+        color.modColor(
+            int(profile * (float(color.brightness()) / 323.0f + .21f)));
+      }
+
+      position((chunkX << 4) + cellX, (chunkZ << 4) + cellZ, pixelX, pixelY);
+      memcpy(pixel(pixelX, pixelY), &color, BYTESPERPIXEL);
+      markDrawn(pixelX, pixelY, pixelX, pixelY);
+    }
+  }
+}
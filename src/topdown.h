@@ -0,0 +1,39 @@
+#ifndef TOPDOWN_H_
+#define TOPDOWN_H_
+
+#include "./canvas.h"
+
+// Top-down canvas
+// An orthographic view of the terrain seen from above, one pixel per block
+// column. Instead of drawing every block, the highest one of every column is
+// located with the height maps stored in the chunks, and only the blocks from
+// there down to the first opaque one are decoded. Water is tinted according
+// to its depth. The corner named by the orientation is in the top left of the
+// image.
+struct TopDownCanvas : public Canvas {
+  bool shading;
+
+  uint32_t sizeX, sizeZ; // The size of the map, in pixels
+  uint8_t scale;         // A pixel stands for 2^scale columns on each side
+
+  Colors::Palette palette; // The colors to use when drawing
+
+  TopDownCanvas(const Terrain::Coordinates &coords,
+                const Colors::Palette &colors, const uint16_t padding = 0,
+                const uint8_t scale = 0, const Allocator &allocator = nullptr);
+
+  // The pixel of a block column, from its world coordinates
+  void position(const int32_t x, const int32_t z, uint32_t &pixelX,
+                uint32_t &pixelY) const;
+
+  void imageOrigin(int64_t *, int64_t *) const override;
+
+  // Copy the pixels of a canvas covering a part of this one
+  void merge(const TopDownCanvas &subCanvas);
+
+  // Drawing entrypoints
+  void renderTerrain(const Terrain::Data &);
+  void renderChunk(const Terrain::Data &, const int32_t, const int32_t);
+};
+
+#endif // TOPDOWN_H_
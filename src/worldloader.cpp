@@ -2,71 +2,175 @@
 
 NBT minecraft_air(nbt::tag_type::tag_end);
 
+uint64_t Terrain::ChunkSet::count() const {
+  uint64_t total = 0;
+
+  for (auto &region : regions)
+    total += region.second.count();
+
+  return total;
+}
+
+uint64_t Terrain::ChunkSet::count(const Coordinates &bounds) const {
+  uint64_t total = 0;
+
+  for (auto &region : regions) {
+    const int32_t regionX = keyX(region.first), regionZ = keyZ(region.first);
+
+    // Skip the regions entirely out of the boundaries
+    if ((regionX << 5) > bounds.maxX || ((regionX + 1) << 5) <= bounds.minX ||
+        (regionZ << 5) > bounds.maxZ || ((regionZ + 1) << 5) <= bounds.minZ)
+      continue;
+
+    for (uint16_t chunk = 0; chunk < REGIONSIZE * REGIONSIZE; chunk++) {
+      const int32_t chunkX = (regionX << 5) + (chunk & 0x1f),
+                    chunkZ = (regionZ << 5) + (chunk >> 5);
+
+      if (region.second.test(chunk) && chunkX >= bounds.minX &&
+          chunkX <= bounds.maxX && chunkZ >= bounds.minZ &&
+          chunkZ <= bounds.maxZ)
+        total++;
+    }
+  }
+
+  return total;
+}
+
+void Terrain::ChunkSet::extent(Coordinates *bounds) const {
+  bounds->setUndefined();
+
+  for (auto &region : regions) {
+    const int32_t regionX = keyX(region.first), regionZ = keyZ(region.first);
+
+    for (uint16_t chunk = 0; chunk < REGIONSIZE * REGIONSIZE; chunk++) {
+      if (!region.second.test(chunk))
+        continue;
+
+      bounds->minX =
+          std::min(bounds->minX, int32_t((regionX << 5) + (chunk & 0x1f)));
+      bounds->maxX =
+          std::max(bounds->maxX, int32_t((regionX << 5) + (chunk & 0x1f)));
+      bounds->minZ =
+          std::min(bounds->minZ, int32_t((regionZ << 5) + (chunk >> 5)));
+      bounds->maxZ =
+          std::max(bounds->maxZ, int32_t((regionZ << 5) + (chunk >> 5)));
+    }
+  }
+
+  // Convert chunk indexes to blocks
+  bounds->minX = bounds->minX << 4;
+  bounds->minZ = bounds->minZ << 4;
+  bounds->maxX = ((bounds->maxX + 1) << 4) - 1;
+  bounds->maxZ = ((bounds->maxZ + 1) << 4) - 1;
+}
+
+void Terrain::ChunkSet::intersect(const ChunkSet &other) {
+  for (auto region = regions.begin(); region != regions.end();) {
+    auto match = other.regions.find(region->first);
+
+    if (match != other.regions.end())
+      region->second &= match->second;
+
+    // Drop the regions left without chunks
+    if (match == other.regions.end() || region->second.none())
+      region = regions.erase(region);
+    else
+      ++region;
+  }
+}
+
 void scanWorldDirectory(const std::filesystem::path &regionDir,
-                        Coordinates *savedWorld) {
+                        Coordinates *savedWorld, Terrain::ChunkSet *existing) {
   const char delimiter = '.';
-  std::string index;
-  char buffer[4];
-  int32_t regionX, regionZ;
-  savedWorld->setUndefined();
+  std::vector<std::filesystem::path> regionFiles;
+  Terrain::ChunkSet found;
 
   for (auto &region : std::filesystem::directory_iterator(regionDir)) {
+    // Only consider files named 'r.x.y.mca'; other files can live in this
+    // directory
+    const string name = region.path().filename().string();
+    if (name.rfind("r.", 0) == 0 && region.path().extension() == ".mca")
+      regionFiles.push_back(region.path());
+  }
+
+  // The headers are independent, read them in parallel
+#ifndef DISABLE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (size_t file = 0; file < regionFiles.size(); file++) {
     // This loop parses files with name 'r.x.y.mca', extracting x and y. This is
     // done by creating a string stream and using `getline` with '.' as a
     // delimiter.
-    std::stringstream ss(region.path().filename().c_str());
+    std::string index;
+    uint8_t header[REGION_HEADER_SIZE];
+    Terrain::ChunkSet::RegionBitmap bitmap;
+
+    std::stringstream ss(regionFiles[file].filename().c_str());
     std::getline(ss, index, delimiter); // This removes the 'r.'
     std::getline(ss, index, delimiter);
 
-    regionX = atoi(index.c_str());
+    const int32_t regionX = atoi(index.c_str());
 
     std::getline(ss, index, delimiter);
 
-    regionZ = atoi(index.c_str());
+    const int32_t regionZ = atoi(index.c_str());
 
-    std::ifstream regionData(region.path());
-    for (uint16_t chunk = 0; chunk < REGIONSIZE * REGIONSIZE; chunk++) {
-      regionData.read(buffer, 4);
+    // Read the location table in one go, instead of one entry at a time
+    FILE *regionHandle = fopen(regionFiles[file].c_str(), "rb");
+    if (!regionHandle)
+      continue;
 
-      if (*((uint32_t *)&buffer) == 0) {
-        continue;
-      }
+    const size_t read =
+        fread(header, sizeof(uint8_t), REGION_HEADER_SIZE, regionHandle);
+    fclose(regionHandle);
 
-      savedWorld->minX =
-          std::min(savedWorld->minX, int32_t((regionX << 5) + (chunk & 0x1f)));
-      savedWorld->maxX =
-          std::max(savedWorld->maxX, int32_t((regionX << 5) + (chunk & 0x1f)));
-      savedWorld->minZ =
-          std::min(savedWorld->minZ, int32_t((regionZ << 5) + (chunk >> 5)));
-      savedWorld->maxZ =
-          std::max(savedWorld->maxZ, int32_t((regionZ << 5) + (chunk >> 5)));
-    }
+    for (uint16_t chunk = 0; chunk < read / 4; chunk++)
+      if (*((uint32_t *)(header + chunk * 4)))
+        bitmap.set(chunk);
+
+    if (bitmap.none())
+      continue;
+
+#ifndef DISABLE_OMP
+#pragma omp critical
+#endif
+    found.regions[Terrain::chunkKey(regionX, regionZ)] = bitmap;
   }
 
-  // Convert region indexes to blocks
-  savedWorld->minX = savedWorld->minX << 4;
-  savedWorld->minZ = savedWorld->minZ << 4;
-  savedWorld->maxX = ((savedWorld->maxX + 1) << 4) - 1;
-  savedWorld->maxZ = ((savedWorld->maxZ + 1) << 4) - 1;
+  // Compute the extent of the world from the chunks found
+  found.extent(savedWorld);
+
+  logger::debug("World spans from {}.{} to {}.{}, {} chunks found\n",
+                savedWorld->minX, savedWorld->minZ, savedWorld->maxX,
+                savedWorld->maxZ, found.count());
 
-  logger::debug("World spans from {}.{} to {}.{}\n", savedWorld->minX,
-                savedWorld->minZ, savedWorld->maxX, savedWorld->maxZ);
+  if (existing)
+    *existing = std::move(found);
 }
 
-void Terrain::Data::load(const std::filesystem::path &regionDir) {
+void Terrain::Data::load(const std::filesystem::path &regionDir,
+                         const ChunkSet *existing) {
+  // Size the containers for the chunks to load, if known
+  if (existing) {
+    const uint64_t expected = existing->count(map);
+    chunks.reserve(expected);
+    heightMap.reserve(expected);
+  }
+
   // Parse all the necessary region files
   for (int16_t rx = REGION(map.minX); rx < REGION(map.maxX) + 1; rx++) {
     for (int16_t rz = REGION(map.minZ); rz < REGION(map.maxZ) + 1; rz++) {
       std::filesystem::path regionFile = std::filesystem::path(regionDir) /=
           "r." + std::to_string(rx) + "." + std::to_string(rz) + ".mca";
 
-      if (!std::filesystem::exists(regionFile)) {
+      if ((existing && !existing->containsRegion(rx, rz)) ||
+          !std::filesystem::exists(regionFile)) {
         logger::debug("Region file r.{}.{}.mca does not exist, skipping ..\n",
                       rx, rz);
         continue;
       }
 
-      loadRegion(regionFile, rx, rz);
+      loadRegion(regionFile, rx, rz, existing);
       // Printing the progress requires the coordinates to be re-mapped from 0,
       // hence the awful pasta dish here.
 #define SIZEX (REGION(map.maxX) - REGION(map.minX) + 1)
@@ -79,26 +183,25 @@ void Terrain::Data::load(const std::filesystem::path &regionDir) {
 #undef SIZEZ
     }
   }
+
+  // The floors depend on the columns around, in the chunks loaded after
+  if (surfaceDepth)
+    trimChunks();
 }
 
 void Terrain::Data::loadRegion(const std::filesystem::path &regionFile,
-                               const int regionX, const int regionZ) {
-  FILE *regionHandle;
-  uint8_t regionHeader[REGION_HEADER_SIZE];
-
-  if (!(regionHandle = fopen(regionFile.c_str(), "rb"))) {
-    logger::error("Opening region file {} failed: {}\n", regionFile.c_str(),
-                  strerror(errno));
-    return;
+                               const int regionX, const int regionZ,
+                               const ChunkSet *existing) {
+  // The region is shared with the other users of the cache: it is opened and
+  // its header is read only once for all of them
+  std::shared_ptr<Region> region;
+  {
+    Profiler::Timer timer(Profiler::REGION_IO);
+    region = RegionCache::global().open(regionFile, regionX, regionZ);
   }
-  // Then, we read the header (of size 4K) storing the chunks locations
 
-  if (fread(regionHeader, sizeof(uint8_t), REGION_HEADER_SIZE, regionHandle) !=
-      REGION_HEADER_SIZE) {
-    logger::error("Region header too short in {}\n", regionFile.c_str());
-    fclose(regionHandle);
+  if (!region)
     return;
-  }
 
   // For all the chunks in the file
   for (int it = 0; it < REGIONSIZE * REGIONSIZE; it++) {
@@ -111,13 +214,11 @@ void Terrain::Data::loadRegion(const std::filesystem::path &regionFile,
       continue;
     }
 
-    // Get the location of the data from the header
-    const uint32_t offset = (_ntohl(regionHeader + it * 4) >> 8) * 4096;
+    if (existing && !existing->contains(chunkX, chunkZ))
+      continue;
 
-    loadChunk(offset, regionHandle, chunkX, chunkZ, regionFile);
+    loadChunk(*region, it, chunkX, chunkZ);
   }
-
-  fclose(regionHandle);
 }
 
 void Terrain::Data::inflateChunk(vector<NBT> *sections) {
@@ -171,6 +272,80 @@ void Terrain::Data::stripChunk(vector<NBT> *sections) {
   }
 }
 
+void Terrain::Data::readSurface(const NBT &chunk, const uint64_t chunkPos) {
+  // The height map of the blocks stopping motion, leaves aside, gives the
+  // height over the ground or the water of every column, trees not hiding
+  // what is under them. Columns without such a block, like the ones of leaves
+  // only, use the one of any block. Chunks without them are drawn whole.
+  if (!chunk["Level"].contains("Heightmaps"))
+    return;
+
+  const NBT &heightmaps = chunk["Level"]["Heightmaps"];
+  const bool post116 = chunk["DataVersion"].get<int>() >= 2534;
+  uint16_t ground[256], surface[256];
+
+  if (!heightmaps.contains("MOTION_BLOCKING_NO_LEAVES") ||
+      !heightmaps.contains("WORLD_SURFACE") ||
+      !decodeHeightmap(heightmaps["MOTION_BLOCKING_NO_LEAVES"]
+                           .get<const std::vector<int64_t> *>(),
+                       post116, ground) ||
+      !decodeHeightmap(
+          heightmaps["WORLD_SURFACE"].get<const std::vector<int64_t> *>(),
+          post116, surface))
+    return;
+
+  std::array<uint16_t, 256> &heights = surfaces[chunkPos];
+  for (uint16_t column = 0; column < 256; column++)
+    heights[column] = std::min<uint16_t>(
+        ground[column] ? ground[column] : surface[column], 256);
+}
+
+void Terrain::Data::trimChunks() {
+  // The surface of a column of the terrain loaded, 0 for the columns of the
+  // chunks not loaded or without a height map: their sides are seen
+  auto surfaceAt = [this](const int64_t x, const int64_t z) -> uint16_t {
+    auto heights = surfaces.find(chunkKey(x >> 4, z >> 4));
+    return heights == surfaces.end()
+               ? 0
+               : heights->second[(x & 0x0f) + (z & 0x0f) * 16];
+  };
+
+  for (auto &chunk : surfaces) {
+    const int64_t chunkX = keyX(chunk.first), chunkZ = keyZ(chunk.first);
+    std::array<uint8_t, 256> &floor = floors[chunk.first];
+    uint8_t lowest = 255;
+
+    // Empty columns have nothing to draw. The others are drawn down to the
+    // depth under their surface, or under the lowest of the columns around
+    // them, for the blocks whose side is seen to be drawn.
+    for (uint8_t z = 0; z < 16; z++)
+      for (uint8_t x = 0; x < 16; x++) {
+        const uint16_t column = x + z * 16, height = chunk.second[column];
+
+        if (!height) {
+          floor[column] = 255;
+          continue;
+        }
+
+        const int64_t blockX = (chunkX << 4) + x, blockZ = (chunkZ << 4) + z;
+        const int16_t seen = std::min(
+            {height, surfaceAt(blockX - 1, blockZ),
+             surfaceAt(blockX + 1, blockZ), surfaceAt(blockX, blockZ - 1),
+             surfaceAt(blockX, blockZ + 1)});
+
+        floor[column] = std::max(seen - surfaceDepth, 0);
+        lowest = std::min(lowest, floor[column]);
+      }
+
+    // The sections under every floor are skipped without being decoded
+    uint16_t &bounds = heightMap[chunk.first];
+    if (lowest > (bounds & 0xff))
+      bounds = (bounds & 0xff00) | lowest;
+  }
+
+  surfaces.clear();
+}
+
 void Terrain::Data::cacheColors(vector<NBT> *sections) {
   // Complete the cache, to determine the colors to load
   for (auto section : *sections) {
@@ -193,52 +368,68 @@ uint16_t Terrain::Data::importHeight(vector<NBT> *sections) {
   return (chunkMax << 8) | chunkMin;
 }
 
-bool decompressChunk(const uint32_t offset, FILE *regionHandle,
-                     uint8_t *chunkBuffer, uint64_t *length,
-                     const std::filesystem::path &filename) {
-  uint8_t zData[COMPRESSED_BUFFER];
+// Buffers used to read and decompress chunks. They are allocated once for
+// every thread and grow when a chunk does not fit, instead of being allocated
+// on the stack for every chunk.
+thread_local Terrain::ChunkData inflateBuffer(DECOMPRESSED_BUFFER),
+    externalBuffer;
 
-  if (0 != fseek(regionHandle, offset, SEEK_SET)) {
-    logger::debug("Accessing chunk data in file {} failed: {}\n",
-                  filename.string(), strerror(errno));
+bool decompressChunk(const uint8_t *zData, const uint32_t zLength,
+                     const uint8_t compression, Terrain::ChunkData *buffer,
+                     uint64_t *length) {
+  const Compression::Decompressor decompress =
+      Compression::decompressor(compression);
+
+  if (!decompress) {
+    logger::debug("Unsupported chunk compression type {}\n", compression);
     return false;
   }
 
-  // Read the 5 bytes that give the size and type of data
-  if (5 != fread(zData, sizeof(uint8_t), 5, regionHandle)) {
-    logger::debug("Reading chunk size from region file {} failed: {}\n",
-                  filename.string(), strerror(errno));
+  if (!decompress(zData, zLength, buffer, length)) {
+    logger::debug("Decompressing chunk data failed\n");
     return false;
   }
 
-  *length = _ntohl(zData);
-  (*length)--; // Sometimes the data is 1 byte smaller
+  return true;
+}
+
+bool readExternalChunk(const std::filesystem::path &file,
+                       Terrain::ChunkData *buffer) {
+  // Chunks too big to fit in their region are stored in a separate file,
+  // containing only their compressed data
+  std::error_code error;
+  const uint64_t size = std::filesystem::file_size(file, error);
 
-  if (fread(zData, sizeof(uint8_t), *length, regionHandle) != *length) {
-    logger::debug("Not enough data for chunk: {}\n", strerror(errno));
+  if (error) {
+    logger::debug("Accessing external chunk {} failed: {}\n", file.string(),
+                  error.message());
     return false;
   }
 
-  z_stream zlibStream;
-  memset(&zlibStream, 0, sizeof(z_stream));
-  zlibStream.next_in = (Bytef *)zData;
-  zlibStream.next_out = (Bytef *)chunkBuffer;
-  zlibStream.avail_in = *length;
-  zlibStream.avail_out = DECOMPRESSED_BUFFER;
-  inflateInit2(&zlibStream, 32 + MAX_WBITS);
+  buffer->resize(size);
 
-  int status = inflate(&zlibStream, Z_FINISH); // decompress in one step
-  inflateEnd(&zlibStream);
-
-  if (status != Z_STREAM_END) {
-    logger::debug("Decompressing chunk data failed: {}\n", zError(status));
+  FILE *f = fopen(file.c_str(), "rb");
+  if (!f || fread(buffer->data(), sizeof(uint8_t), size, f) != size) {
+    logger::debug("Reading external chunk {} failed: {}\n", file.string(),
+                  strerror(errno));
+    if (f)
+      fclose(f);
     return false;
   }
 
-  *length = zlibStream.total_out;
+  fclose(f);
   return true;
 }
 
+const NBT &Terrain::Data::chunkAt(int64_t xPos, int64_t zPos) const {
+  auto chunk = chunks.find(chunkKey(xPos, zPos));
+
+  if (chunk == chunks.end())
+    return minecraft_air;
+
+  return chunk->second;
+}
+
 bool assertChunk(const NBT &chunk) {
   if (chunk.is_end()                          // Catch uninitialized chunks
       || !chunk.contains("DataVersion")       // Dataversion is required
@@ -250,29 +441,73 @@ bool assertChunk(const NBT &chunk) {
   return true;
 }
 
-void Terrain::Data::loadChunk(const uint32_t offset, FILE *regionHandle,
-                              const int chunkX, const int chunkZ,
-                              const std::filesystem::path &filename) {
-  uint64_t length, chunkPos = chunkIndex(chunkX, chunkZ);
+void Terrain::Data::loadChunk(Region &region, const uint16_t index,
+                              const int chunkX, const int chunkZ) {
+  uint64_t length, chunkPos = chunkKey(chunkX, chunkZ);
+  uint32_t zLength;
+  uint8_t compression, *nbtData;
+  const uint8_t *zData;
+  NBT chunk;
+
+  // Use the decompressed data if another user of the region kept it
+  std::shared_ptr<const ChunkData> cached = region.cached(index);
+
+  if (cached) {
+    nbtData = const_cast<uint8_t *>(cached->data());
+    length = cached->size();
+  } else {
+    if (!region.chunkData(index, &zData, &zLength, &compression))
+      return;
+
+    // The high bit of the compression type marks chunks stored outside of the
+    // region, in a file named after the chunk's coordinates
+    if (compression & 0x80) {
+      Profiler::Timer timer(Profiler::REGION_IO);
+
+      if (!readExternalChunk(region.file.parent_path() /
+                                 fmt::format("c.{}.{}.mcc", chunkX, chunkZ),
+                             &externalBuffer))
+        return;
+
+      zData = externalBuffer.data();
+      zLength = externalBuffer.size();
+    }
 
-  // Buffers for chunk read from MCA files and decompression.
-  uint8_t chunkBuffer[DECOMPRESSED_BUFFER];
+    {
+      Profiler::Timer timer(Profiler::INFLATE);
 
-  if (!offset ||
-      !decompressChunk(offset, regionHandle, chunkBuffer, &length, filename))
-    return;
+      if (!decompressChunk(zData, zLength, compression & 0x7f, &inflateBuffer,
+                           &length))
+        return;
+    }
+
+    Profiler::count(Profiler::COMPRESSED_BYTES, zLength);
+    Profiler::count(Profiler::INFLATED_BYTES, length);
+
+    RegionCache::global().store(region, index, inflateBuffer.data(), length);
+    nbtData = inflateBuffer.data();
+  }
 
-  NBT chunk = NBT::parse(chunkBuffer, length);
+  {
+    Profiler::Timer timer(Profiler::NBT_PARSE);
+    chunk = NBT::parse(nbtData, length);
+  }
 
   if (!assertChunk(chunk))
     return;
 
+  Profiler::Timer timer(Profiler::STRIP);
+  Profiler::count(Profiler::CHUNKS, 1);
+
   chunks[chunkPos] = std::move(chunk);
   vector<NBT> *sections =
       chunks[chunkPos]["Level"]["Sections"].get<vector<NBT> *>();
 
-  // Strip the chunk of pointless sections
+  // Strip the chunk of pointless sections, and read its surface when only the
+  // surface is rendered
   stripChunk(sections);
+  if (surfaceDepth)
+    readSurface(chunks[chunkPos], chunkPos);
 
   if (sections->empty()) {
     heightMap[chunkPos] = 0;
@@ -383,3 +618,139 @@ int16_t blockAtPre116(const uint64_t index_length,
   // lower_data now contains the index in the palette
   return lower_data;
 }
+
+// Bulk decoders
+// The functions above locate a single block; when drawing a whole section,
+// the block states are read sequentially instead, and all the indexes are
+// extracted at once, in the same order as in the section: x, then z, then y.
+
+void decodePost116(const uint64_t index_length,
+                   const std::vector<int64_t> *blockStates, uint16_t *blocks) {
+  // Since 1.16 indexes do not overflow on the next long: each long holds
+  // `64 / index_length` indexes, the remaining bits being padding
+  const uint8_t blocksPerLong = 64 / index_length;
+  const uint64_t mask = (uint64_t(1) << index_length) - 1;
+  uint16_t index = 0;
+
+  for (uint16_t longIndex = 0; index < 4096; longIndex++) {
+    uint64_t data = (*blockStates)[longIndex];
+
+    for (uint8_t i = 0; i < blocksPerLong && index < 4096; i++) {
+      blocks[index++] = data & mask;
+      data >>= index_length;
+    }
+  }
+}
+
+void decodePre116(const uint64_t index_length,
+                  const std::vector<int64_t> *blockStates, uint16_t *blocks) {
+  // Before 1.16, indexes are contiguous and can overflow on the next long
+  const uint64_t mask = (uint64_t(1) << index_length) - 1;
+
+  for (uint32_t index = 0, bit = 0; index < 4096;
+       index++, bit += index_length) {
+    const uint16_t longIndex = bit >> 6;
+    const uint8_t padding = bit & 63;
+
+    uint64_t data = uint64_t((*blockStates)[longIndex]) >> padding;
+    if (padding + index_length > 64)
+      data |= uint64_t((*blockStates)[longIndex + 1]) << (64 - padding);
+
+    blocks[index] = data & mask;
+  }
+}
+
+namespace {
+
+// The layers are read in the order of the blocks, every column collecting a
+// bit per layer. The loop has no branches, to be vectorized.
+template <typename Drawn>
+uint16_t occupancy(const uint16_t *blocks, const Drawn &drawn,
+                   uint16_t *columns) {
+  uint16_t layers = 0;
+  memset(columns, 0, 256 * sizeof(uint16_t));
+
+  for (uint8_t y = 0; y < 16; y++) {
+    const uint16_t *layer = blocks + (y << 8);
+    uint16_t any = 0;
+
+    for (uint16_t column = 0; column < 256; column++) {
+      const uint16_t bit = drawn(layer[column]);
+      columns[column] |= bit << y;
+      any |= bit;
+    }
+
+    layers |= (any != 0) << y;
+  }
+
+  return layers;
+}
+
+} // namespace
+
+uint16_t sectionOccupancy(const uint16_t *blocks, const uint8_t *drawn,
+                          const uint16_t paletteSize, uint16_t *columns) {
+  uint16_t hidden = 0, hiddenIndex = 0;
+  for (uint16_t index = 0; index < paletteSize; index++)
+    if (!drawn[index]) {
+      hidden++;
+      hiddenIndex = index;
+    }
+
+  // Most palettes hide a single block, air: comparing the indexes with it
+  // is cheaper than looking them up
+  if (hidden == 1)
+    return occupancy(
+        blocks, [hiddenIndex](uint16_t index) { return index != hiddenIndex; },
+        columns);
+
+  return occupancy(
+      blocks, [drawn](uint16_t index) { return drawn[index]; }, columns);
+}
+
+uint16_t statesLength(const uint64_t index_length, const bool post116) {
+  // The number of longs needed to store the 4096 indexes of a section
+  if (post116) {
+    const uint8_t blocksPerLong = 64 / index_length;
+    return (4096 + blocksPerLong - 1) / blocksPerLong;
+  }
+
+  return (4096 * index_length + 63) / 64;
+}
+
+bool decodeHeightmap(const std::vector<int64_t> *heights, const bool post116,
+                     uint16_t *columns) {
+  // Height maps store 256 values of 9 bits, one for every column of the chunk
+  // in x, then z order, packed like the block states of the same version.
+  // Every value is the height over the highest block matching the map's
+  // criteria, 0 meaning there is none.
+  const uint8_t bits = 9;
+  const uint64_t mask = (uint64_t(1) << bits) - 1;
+
+  if (post116) {
+    const uint8_t valuesPerLong = 64 / bits;
+    if (heights->size() < (256 + valuesPerLong - 1) / valuesPerLong)
+      return false;
+
+    for (uint16_t index = 0; index < 256; index++)
+      columns[index] = (uint64_t((*heights)[index / valuesPerLong]) >>
+                        (index % valuesPerLong) * bits) &
+                       mask;
+  } else {
+    if (heights->size() < (256 * bits + 63) / 64)
+      return false;
+
+    for (uint32_t index = 0, bit = 0; index < 256; index++, bit += bits) {
+      const uint16_t longIndex = bit >> 6;
+      const uint8_t padding = bit & 63;
+
+      uint64_t data = uint64_t((*heights)[longIndex]) >> padding;
+      if (padding + bits > 64)
+        data |= uint64_t((*heights)[longIndex + 1]) << (64 - padding);
+
+      columns[index] = data & mask;
+    }
+  }
+
+  return true;
+}
@@ -2,98 +2,166 @@
 #define WORLDLOADER_H_
 
 #include "./colors.h"
+#include "./compression.h"
 #include "./helper.h"
+#include "./profiler.h"
+#include "./regioncache.h"
+#include <array>
+#include <bitset>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <nbt/nbt.hpp>
 #include <stdint.h>
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
-#include <zlib.h>
 
 using nbt::NBT;
 using std::string;
 using std::vector;
 
-void scanWorldDirectory(const std::filesystem::path &, Coordinates *);
+// End tag used as an empty value
+extern NBT minecraft_air;
 
 namespace Terrain {
 
 typedef NBT Chunk;
-typedef Chunk *ChunkList;
 
 using Coordinates = struct Coordinates;
 
+// Chunk coordinates packed in a single value, used as a key in the sparse
+// containers below
+inline uint64_t chunkKey(const int32_t x, const int32_t z) {
+  return (uint64_t(uint32_t(x)) << 32) | uint32_t(z);
+}
+inline int32_t keyX(const uint64_t key) { return int32_t(key >> 32); }
+inline int32_t keyZ(const uint64_t key) { return int32_t(key & 0xffffffff); }
+
+// A set of chunks, stored as a bitmap of 32x32 bits for every region holding
+// at least one chunk. This is built from the region headers, and allows to
+// know which chunks exist without allocating memory for the empty space
+// between them.
+struct ChunkSet {
+  typedef std::bitset<REGIONSIZE * REGIONSIZE> RegionBitmap;
+  std::map<uint64_t, RegionBitmap> regions;
+
+  void insert(const int32_t x, const int32_t z) {
+    regions[chunkKey(REGION(x), REGION(z))].set((x & 0x1f) + (z & 0x1f) * 32);
+  }
+
+  bool contains(const int32_t x, const int32_t z) const {
+    auto region = regions.find(chunkKey(REGION(x), REGION(z)));
+    return region != regions.end() &&
+           region->second.test((x & 0x1f) + (z & 0x1f) * 32);
+  }
+
+  bool containsRegion(const int32_t rx, const int32_t rz) const {
+    return regions.find(chunkKey(rx, rz)) != regions.end();
+  }
+
+  // Count the chunks in the set inside the given boundaries, in chunks
+  uint64_t count(const Coordinates &) const;
+  uint64_t count() const;
+
+  // Get the smallest set of coordinates containing all the chunks, in blocks
+  void extent(Coordinates *) const;
+
+  // Only keep the chunks present in both sets
+  void intersect(const ChunkSet &);
+};
+
+} // namespace Terrain
+
+void scanWorldDirectory(const std::filesystem::path &, Coordinates *,
+                        Terrain::ChunkSet * = nullptr);
+
+namespace Terrain {
+
 struct Data {
   // The coordinates of the loaded chunks. This coordinates maps
   // the CHUNKS loaded, not the blocks
   Coordinates map;
 
-  // The internal list of chunks, of size chunkLen
-  ChunkList chunks;
-  uint64_t chunkLen;
+  // The chunks loaded, indexed by their packed coordinates. Only the chunks
+  // existing in the save are stored, making the memory used proportional to
+  // the terrain and not to its bounding box
+  std::unordered_map<uint64_t, Chunk> chunks;
 
-  // An array of bytes, one for each chunk
+  // Two bytes for each loaded chunk
   // the first 8 bits are the highest block to render,
   // the latter the lowest section number
-  uint16_t *heightMap;
+  std::unordered_map<uint64_t, uint16_t> heightMap;
 
   // The global version of the values above. The first 8 bits indicate the
   // highest block to render, the last 8 the lowest block
   uint16_t heightBounds;
 
+  // When set, only the blocks down to this depth under the surface are
+  // rendered, or under the surface of the columns around when it is lower, to
+  // draw the sides they leave in view. The height over the highest block of
+  // every column, then the lowest block to render, in x then z order, are
+  // kept for the chunks having a height map.
+  uint8_t surfaceDepth;
+  std::unordered_map<uint64_t, std::array<uint16_t, 256>> surfaces;
+  std::unordered_map<uint64_t, std::array<uint8_t, 256>> floors;
+
   vector<string> cache;
 
   // Default constructor
-  explicit Data(const Terrain::Coordinates &coords) : heightBounds(0) {
+  explicit Data(const Terrain::Coordinates &coords)
+      : heightBounds(0), surfaceDepth(0) {
     map.minX = CHUNK(coords.minX);
     map.minZ = CHUNK(coords.minZ);
     map.maxX = CHUNK(coords.maxX);
     map.maxZ = CHUNK(coords.maxZ);
-
-    chunkLen =
-        uint64_t(map.maxX - map.minX + 1) * uint64_t(map.maxZ - map.minZ + 1);
-
-    chunks = new Terrain::Chunk[chunkLen];
-    heightMap = new uint16_t[chunkLen];
-  }
-
-  ~Data() {
-    delete[] heightMap;
-    delete[] chunks;
   }
 
-  // Chunk loading methods - only load should be useful
-  void load(const std::filesystem::path &regionDir);
+  // Chunk loading methods - only load should be useful. If given, only the
+  // chunks in the set are loaded, and regions without any are skipped
+  void load(const std::filesystem::path &regionDir,
+            const ChunkSet *existing = nullptr);
   void loadRegion(const std::filesystem::path &regionFile, const int regionX,
-                  const int regionZ);
-  void loadChunk(const uint32_t offset, FILE *regionHandle, const int chunkX,
-                 const int chunkZ, const std::filesystem::path &filename);
+                  const int regionZ, const ChunkSet *existing = nullptr);
+  void loadChunk(Region &region, const uint16_t index, const int chunkX,
+                 const int chunkZ);
 
   // Chunk analysis methods - using the list of sections
   void stripChunk(vector<NBT> *);
+  // Read the surface of every column from the chunk's height map
+  void readSurface(const NBT &, const uint64_t);
+  // Once all the chunks are loaded, find the floor of every column from its
+  // surface and the ones of the columns next to it, and skip the sections
+  // under all the floors of a chunk
+  void trimChunks();
   void cacheColors(vector<NBT> *);
   uint16_t importHeight(vector<NBT> *);
   void inflateChunk(vector<NBT> *);
 
-  uint64_t chunkIndex(int64_t x, int64_t z) const {
-    return (x - map.minX) + (z - map.minZ) * (map.maxX - map.minX + 1);
-  }
-
-  const NBT &chunkAt(int64_t xPos, int64_t zPos) const {
-    return chunks[chunkIndex(xPos, zPos)];
-  }
+  // Accessors, returning empty values for chunks that were not loaded
+  const NBT &chunkAt(int64_t xPos, int64_t zPos) const;
 
   uint8_t maxHeight() const { return heightBounds >> 8; }
   uint8_t minHeight() const { return heightBounds & 0xff; }
 
+  uint16_t heightAt(const int64_t x, const int64_t z) const {
+    auto height = heightMap.find(chunkKey(x, z));
+    return height == heightMap.end() ? 0 : height->second;
+  }
+
   uint8_t maxHeight(const int64_t x, const int64_t z) const {
-    return heightMap[chunkIndex(x, z)] >> 8;
+    return heightAt(x, z) >> 8;
   }
 
   uint8_t minHeight(const int64_t x, const int64_t z) const {
-    return heightMap[chunkIndex(x, z)] & 0xff;
+    return heightAt(x, z) & 0xff;
+  }
+
+  // The floors of the columns of a chunk, or nullptr if they are all drawn
+  const uint8_t *floorAt(const int64_t x, const int64_t z) const {
+    auto floor = floors.find(chunkKey(x, z));
+    return floor == floors.end() ? nullptr : floor->second.data();
   }
 };
 
@@ -108,5 +176,29 @@ int16_t blockAtPre116(const uint64_t, const std::vector<int64_t> *, uint8_t,
 int16_t blockAtPost116(const uint64_t, const std::vector<int64_t> *, uint8_t,
                        uint8_t, uint8_t);
 
+typedef void (*sectionDecoder)(const uint64_t, const std::vector<int64_t> *,
+                               uint16_t *);
+
+void decodePre116(const uint64_t, const std::vector<int64_t> *, uint16_t *);
+void decodePost116(const uint64_t, const std::vector<int64_t> *, uint16_t *);
+
+// Find the blocks to draw in a decoded section, from a flag (0 or 1) for every
+// possible palette index, the indexes past the palette being set. Every
+// column, in x then z order, gets a mask of the blocks to draw from the
+// bottom; the mask of the layers holding any of them is returned.
+uint16_t sectionOccupancy(const uint16_t *, const uint8_t *, const uint16_t,
+                          uint16_t *);
+
+uint16_t statesLength(const uint64_t, const bool);
+
+// Decode the 256 columns of a chunk's height map, stored in the Heightmaps
+// compound. Returns false if the array is too short.
+bool decodeHeightmap(const std::vector<int64_t> *, const bool, uint16_t *);
+
+// Decompress the data of a chunk into the buffer, growing it when needed, with
+// the method given by the compression type of the chunk
+bool decompressChunk(const uint8_t *, const uint32_t, const uint8_t,
+                     Terrain::ChunkData *, uint64_t *);
+
 bool assertChunk(const NBT &);
 #endif // WORLDLOADER_H_